@@ -0,0 +1,148 @@
+//
+//  AtomicEdgePtr.h
+//
+//  An EdgePtr which can be read and written by
+//  several threads at once.
+//
+
+#ifndef __Dev__AtomicEdgePtr__
+#define __Dev__AtomicEdgePtr__
+
+#include "Collector.hpp"
+
+// An EdgePtr with atomic load, store and compare_exchange,
+// for lock-free data structures. The collector takes care
+// of reclamation, so no hazard pointers or epochs are
+// needed.
+//
+// Events are ordered around each update: the edge to the
+// new value is added before it's published, and the edge
+// to the old value is removed after it's replaced, so the
+// collector may briefly see both but never neither. Loads
+// return a RootPtr, registered in a way Collect waits for,
+// so a value replaced right after it was read stays alive.
+//
+// Loads only synchronize with the collector in the same
+// process, so don't share these across a SharedHeap.
+template<typename T>
+class AtomicEdgePtr {
+
+public:
+
+  // Every AtomicEdgePtr must have an owner.
+  explicit AtomicEdgePtr(Collectable* owner) : _owner(owner), _ptr(0) {
+    assert(owner);
+  }
+
+  AtomicEdgePtr(Collectable* owner, const RootPtr<T>& p) : _owner(owner), _ptr(p.Get()) {
+    assert(owner);
+    _Retain(p.Get());
+  }
+
+  ~AtomicEdgePtr() {
+
+    // If we're not in the GC thread.
+    if(! Collector::GetInstance().InGC()) {
+      _Release(_ptr.load());
+    }
+
+  }
+
+  RootPtr<T> load() const {
+
+    Collector& collector = Collector::GetInstance();
+    size_t epoch = collector.BeginLoad();
+
+    RootPtr<T> p(_ptr.load(std::memory_order_acquire));
+
+    collector.EndLoad(epoch);
+
+    return p;
+  }
+
+  void store(const RootPtr<T>& p) {
+    _Retain(p.Get());
+    T* old = _ptr.exchange(p.Get(), std::memory_order_acq_rel);
+    _Release(old);
+  }
+
+  RootPtr<T> exchange(const RootPtr<T>& p) {
+    _Retain(p.Get());
+    RootPtr<T> old(_ptr.exchange(p.Get(), std::memory_order_acq_rel));
+    _Release(old.Get());
+    return old;
+  }
+
+  // If the value is expected, replace it with desired
+  // and return true. Otherwise load the current value
+  // into expected and return false.
+  bool compare_exchange(RootPtr<T>& expected, const RootPtr<T>& desired) {
+
+    _Retain(desired.Get());
+
+    T* value = expected.Get();
+
+    if(_ptr.compare_exchange_strong(value, desired.Get(), std::memory_order_acq_rel)) {
+      _Release(expected.Get());
+      return true;
+    }
+
+    _Release(desired.Get());
+    expected = load();
+    return false;
+  }
+
+  // The current value, unrooted. Only safe when no other
+  // thread can replace it, say while holding a lock, or
+  // inside a LoadGuard.
+  T* Get() const { return _ptr.load(std::memory_order_acquire); }
+
+  operator bool() const { return Get() != 0; }
+
+private:
+
+  AtomicEdgePtr(const AtomicEdgePtr&);
+  AtomicEdgePtr& operator=(const AtomicEdgePtr&);
+
+  void _Retain(T* p) {
+    if(p) {
+      Collector::GetInstance().AddEdge(_owner, p);
+    }
+  }
+
+  void _Release(T* p) {
+    if(p) {
+      Collector::GetInstance().RemoveEdge(_owner, p);
+    }
+  }
+
+  Collectable* _owner;
+  std::atomic<T*> _ptr;
+
+}; // class AtomicEdgePtr
+
+// Everything read with AtomicEdgePtr::Get while a LoadGuard
+// is alive stays alive until it's destroyed, since Collect
+// waits for guards before its final pass over the events.
+// Cheaper than rooting each step of a traversal, but keep
+// guards short, and RootPtr anything you need afterwards
+// before the guard goes away. Collect drains events while
+// it waits, so rooting inside a guard is fine, but calling
+// Collect or Checkpoint from inside one never returns.
+class LoadGuard {
+
+public:
+
+  LoadGuard() : _epoch(Collector::GetInstance().BeginLoad()) { }
+  ~LoadGuard() { Collector::GetInstance().EndLoad(_epoch); }
+
+private:
+
+  LoadGuard(const LoadGuard&);
+  LoadGuard& operator=(const LoadGuard&);
+
+  size_t _epoch;
+
+};
+
+#endif /* defined(__Dev__AtomicEdgePtr__) */
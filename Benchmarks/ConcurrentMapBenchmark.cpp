@@ -0,0 +1,236 @@
+//
+//  ConcurrentMapBenchmark.cpp
+//
+//  Compares ConcurrentMap against std::unordered_map
+//  behind a mutex, with readers, one writer at a fixed
+//  rate and a thread collecting, for a fixed time each.
+//
+//  g++ -std=c++11 -O2 -I.. ConcurrentMapBenchmark.cpp ../*.cpp
+//    -lboost_thread -lboost_system -lpthread
+//
+//  ConcurrentMapBenchmark [readers] [keys] [seconds] [writes/s]
+//
+
+#include "ConcurrentMap.hpp"
+#include <boost/thread/shared_mutex.hpp>
+#include <unordered_map>
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+struct Value : public Collectable {
+  explicit Value(int k) : key(k) { }
+  int key;
+};
+
+// The same interface over each map. Lookups read the
+// value's key rather than returning it, since rooting it
+// would queue two events per lookup, and they'd measure
+// the collector instead.
+class LockedMap {
+
+public:
+
+  int Lookup(int key) const {
+    boost::mutex::scoped_lock lock(_mutex);
+    auto found = _map.find(key);
+    return found == _map.end() ? -1 : found->second->key;
+  }
+
+  void Insert(int key, const RootPtr<Value>& value) {
+    boost::mutex::scoped_lock lock(_mutex);
+    _map[key] = value;
+  }
+
+  void Erase(int key) {
+    boost::mutex::scoped_lock lock(_mutex);
+    _map.erase(key);
+  }
+
+private:
+
+  mutable boost::mutex _mutex;
+  std::unordered_map< int, RootPtr<Value> > _map;
+};
+
+class SharedLockedMap {
+
+public:
+
+  int Lookup(int key) const {
+    boost::shared_lock<boost::shared_mutex> lock(_mutex);
+    auto found = _map.find(key);
+    return found == _map.end() ? -1 : found->second->key;
+  }
+
+  void Insert(int key, const RootPtr<Value>& value) {
+    boost::unique_lock<boost::shared_mutex> lock(_mutex);
+    _map[key] = value;
+  }
+
+  void Erase(int key) {
+    boost::unique_lock<boost::shared_mutex> lock(_mutex);
+    _map.erase(key);
+  }
+
+private:
+
+  mutable boost::shared_mutex _mutex;
+  std::unordered_map< int, RootPtr<Value> > _map;
+};
+
+class GcMap {
+
+public:
+
+  int Lookup(int key) const {
+    LoadGuard guard;
+    Value* value = _map.Get(key);
+    return value ? value->key : -1;
+  }
+  void Insert(int key, const RootPtr<Value>& value) { _map.Insert(key, value); }
+  void Erase(int key) { _map.Erase(key); }
+
+private:
+
+  ConcurrentMap<int, Value> _map;
+};
+
+template<typename Map>
+void Run(const char* name, size_t readers, int keys, double seconds, double writeRate) {
+
+  Collector& collector = Collector::GetInstance();
+
+  Map map;
+
+  // Filling and emptying the map aren't timed, so drain
+  // as they go. Growing a ConcurrentMap copies every entry
+  // at once, which can still fill the queue for a moment.
+  for(int key = 0; key < keys; ++key) {
+    map.Insert(key, RootPtr<Value>(new Value(key)));
+
+    if(key % 1000 == 0) {
+      collector.ProcessEvents();
+    }
+  }
+
+  collector.ProcessEvents();
+
+  std::atomic<bool> running(true);
+  std::atomic<size_t> reads(0);
+  std::atomic<size_t> wrong(0);
+  size_t writes = 0;
+
+  boost::thread_group threads;
+
+  for(size_t i = 0; i < readers; ++i) {
+    threads.create_thread([&, i]() {
+      unsigned seed = unsigned(i) * 7919 + 1;
+      size_t count = 0;
+
+      while(running) {
+        seed = seed * 1103515245 + 12345;
+        int key = int((seed >> 8) % keys);
+
+        int found = map.Lookup(key);
+
+        if(found != -1 && found != key) {
+          wrong++;
+        }
+
+        ++count;
+      }
+
+      reads += count;
+    });
+  }
+
+  // The writer replaces or erases random keys at about
+  // writeRate a second, a millisecond's worth at a time,
+  // without catching up after falling behind, so the
+  // collector can keep up and the readers are what's
+  // measured.
+  auto start = std::chrono::steady_clock::now();
+  unsigned seed = 12345;
+  size_t perTick = std::max(size_t(writeRate / 1000), size_t(1));
+
+  while(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() < seconds) {
+
+    for(size_t i = 0; i < perTick; ++i) {
+      seed = seed * 1103515245 + 12345;
+      int key = int((seed >> 8) % keys);
+
+      if(seed & 0x10000) {
+        map.Insert(key, RootPtr<Value>(new Value(key)));
+      } else {
+        map.Erase(key);
+      }
+
+      ++writes;
+    }
+
+    boost::this_thread::sleep(boost::posix_time::millisec(1));
+  }
+
+  running = false;
+  threads.join_all();
+
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::cout << name << ": "
+            << size_t(reads / elapsed) << " reads/s, "
+            << size_t(writes / elapsed) << " writes/s";
+
+  if(wrong) {
+    std::cout << ", " << wrong << " wrong values";
+  }
+
+  std::cout << std::endl;
+
+  for(int key = 0; key < keys; ++key) {
+    map.Erase(key);
+
+    if(key % 1000 == 0) {
+      collector.ProcessEvents();
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+
+  size_t readers = argc > 1 ? std::strtoul(argv[1], 0, 10) : 4;
+  int keys = argc > 2 ? std::atoi(argv[2]) : 100000;
+  double seconds = argc > 3 ? std::atof(argv[3]) : 2;
+  double writeRate = argc > 4 ? std::atof(argv[4]) : 10000;
+
+  std::cout << readers << " readers, 1 writer, " << keys << " keys, "
+            << boost::thread::hardware_concurrency() << " cores" << std::endl;
+
+  // Drain continuously, and collect every 100ms.
+  std::atomic<bool> running(true);
+
+  boost::thread collecting([&]() {
+    Collector& collector = Collector::GetInstance();
+    auto lastCollect = std::chrono::steady_clock::now();
+
+    while(running) {
+      collector.ProcessEvents();
+
+      auto now = std::chrono::steady_clock::now();
+      if(now - lastCollect > std::chrono::milliseconds(100)) {
+        collector.Collect();
+        lastCollect = now;
+      }
+
+      boost::this_thread::yield();
+    }
+  });
+
+  Run<LockedMap>("unordered_map + mutex", readers, keys, seconds, writeRate);
+  Run<SharedLockedMap>("unordered_map + shared_mutex", readers, keys, seconds, writeRate);
+  Run<GcMap>("ConcurrentMap", readers, keys, seconds, writeRate);
+
+  running = false;
+  collecting.join();
+  return 0;
+}
@@ -0,0 +1,438 @@
+//
+//  Checkpoint.cpp
+//
+
+#include "Checkpoint.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace {
+
+  // The file is laid out as the header, followed by the
+  // node records, the edge targets (indices into the node
+  // records), the type names and finally the payload
+  // written by GCSave. Everything but the type names and
+  // payload can be used in place once mapped.
+  const char Magic[8] = { 'G', 'C', 'C', 'K', 'P', 'T', '0', '1' };
+  const uint32_t Version = 1;
+  const uint64_t NullNode = ~uint64_t(0);
+
+  struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t typeCount;
+    uint64_t nodeCount;
+    uint64_t edgeCount;
+    uint64_t nodesOffset;
+    uint64_t edgesOffset;
+    uint64_t typesOffset;
+    uint64_t payloadOffset;
+    uint64_t payloadSize;
+  };
+
+  struct NodeRecord {
+    uint32_t type;
+    uint32_t rootCount;
+    uint64_t payloadOffset;
+    uint64_t payloadSize;
+    uint64_t edgeBegin;
+    uint64_t edgeEnd;
+  };
+
+  uint64_t Align(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+  }
+
+}
+
+void CheckpointWriter::Write(const void* data, size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  _buffer.insert(_buffer.end(), bytes, bytes + size);
+}
+
+void CheckpointWriter::WriteString(const std::string& str) {
+  Write(uint64_t(str.size()));
+  Write(str.data(), str.size());
+}
+
+void CheckpointWriter::_WriteNode(Collectable* node) {
+
+  uint64_t index = NullNode;
+
+  if(node && _indicesById) {
+
+    // Cloned nodes only point to nodes in the clone.
+    assert(node->gcId < _indicesById->size() && (*_indicesById)[node->gcId] != ~uint32_t(0));
+
+    index = (*_indicesById)[node->gcId];
+  } else if(node) {
+    auto iter = _indices->find(node);
+
+    // Live nodes only point to live nodes.
+    assert(iter != _indices->end());
+
+    index = iter->second;
+  }
+
+  Write(index);
+}
+
+void CheckpointReader::Read(void* data, size_t size) {
+
+  // Reading more than GCSave wrote.
+  assert(_offset + size <= _size);
+
+  if(_offset + size > _size) {
+    memset(data, 0, size);
+    return;
+  }
+
+  memcpy(data, _data + _offset, size);
+  _offset += size;
+}
+
+std::string CheckpointReader::ReadString() {
+
+  uint64_t size = 0;
+  Read(size);
+
+  std::string str(size_t(std::min<uint64_t>(size, _size - _offset)), '\0');
+  Read(&str[0], str.size());
+
+  return str;
+}
+
+Collectable* CheckpointReader::_ReadNode() {
+
+  uint64_t index = NullNode;
+  Read(index);
+
+  if(index == NullNode) {
+    return 0;
+  }
+
+  assert(index < _nodes.size());
+  return index < _nodes.size() ? _nodes[size_t(index)] : 0;
+}
+
+bool Collector::Checkpoint(const std::string& path) {
+
+  boost::mutex::scoped_lock lock(_mutex);
+
+  if(_InWorker()) {
+    std::cout << "Warning: only the process which created the SharedHeap can checkpoint" << std::endl;
+    return false;
+  }
+
+  _ProcessEvents();
+  _Mark();
+
+  // Number the live nodes.
+  std::vector<Collectable*> live;
+  CheckpointWriter::IndexMap indices;
+
+  for(NodeId id = 0; id < _nodes.size(); ++id) {
+    if(_info[id].tracked && _info[id].sequence == _sequence) {
+      indices[_nodes[id]] = live.size();
+      live.push_back(_nodes[id]);
+    }
+  }
+
+  // Nodes held by root containers are
+  // restored as roots.
+  std::vector<Collectable*> held;
+
+  {
+    boost::mutex::scoped_lock containerLock(_containerMutex);
+
+    for(auto container : _containers) {
+      container->GCTrace(held);
+    }
+  }
+
+  std::sort(held.begin(), held.end());
+
+  std::vector<NodeRecord> records(live.size());
+  std::vector<uint64_t> edges;
+  std::vector<char> payload;
+
+  // Only the registered types which are used
+  // are written, indexed in order of first use.
+  std::vector<size_t> fileTypes;
+  std::vector<uint32_t> fileTypeIndices(_types.size(), ~uint32_t(0));
+
+  CheckpointWriter writer(indices, payload);
+
+  for(size_t i = 0; i < live.size(); ++i) {
+
+    Collectable* node = live[i];
+    NodeRecord& record = records[i];
+
+    auto iter = _typeIndices.find(typeid(*node));
+
+    if(iter == _typeIndices.end()) {
+      std::cout << "Warning: can't checkpoint unregistered type "
+                << typeid(*node).name() << std::endl;
+      return false;
+    }
+
+    if(fileTypeIndices[iter->second] == ~uint32_t(0)) {
+      fileTypeIndices[iter->second] = uint32_t(fileTypes.size());
+      fileTypes.push_back(iter->second);
+    }
+
+    record.type = fileTypeIndices[iter->second];
+    const NodeInfo& info = _info[node->gcId];
+
+    record.rootCount = uint32_t(info.rootCount);
+
+    if(std::binary_search(held.begin(), held.end(), node)) {
+      record.rootCount++;
+    }
+
+    record.payloadOffset = payload.size();
+    node->GCSave(writer);
+    record.payloadSize = payload.size() - record.payloadOffset;
+
+    record.edgeBegin = edges.size();
+    for(auto adj : info.connections) {
+
+      auto target = indices.find(_nodes[adj]);
+
+      // Live nodes only point to live nodes.
+      assert(target != indices.end());
+
+      if(target == indices.end()) {
+        std::cout << "Warning: can't checkpoint an edge to a node that wasn't marked" << std::endl;
+        return false;
+      }
+
+      edges.push_back(target->second);
+    }
+    record.edgeEnd = edges.size();
+  }
+
+  std::vector<char> typeNames;
+  for(auto type : fileTypes) {
+    const std::string& name = _types[type].name;
+    uint32_t size = uint32_t(name.size());
+    typeNames.insert(typeNames.end(), (const char*) &size, (const char*) &size + sizeof(size));
+    typeNames.insert(typeNames.end(), name.begin(), name.end());
+  }
+
+  FileHeader header;
+  memcpy(header.magic, Magic, sizeof(Magic));
+  header.version = Version;
+  header.typeCount = uint32_t(fileTypes.size());
+  header.nodeCount = records.size();
+  header.edgeCount = edges.size();
+  header.nodesOffset = sizeof(FileHeader);
+  header.edgesOffset = header.nodesOffset + records.size() * sizeof(NodeRecord);
+  header.typesOffset = header.edgesOffset + edges.size() * sizeof(uint64_t);
+  header.payloadOffset = Align(header.typesOffset + typeNames.size());
+  header.payloadSize = payload.size();
+
+  // Write to a temporary file and rename, so a crash
+  // doesn't leave a partial checkpoint behind.
+  std::string tmpPath = path + ".tmp";
+
+  {
+    std::ofstream out(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+
+    const char padding[8] = { 0 };
+
+    out.write((const char*) &header, sizeof(header));
+    out.write((const char*) records.data(), records.size() * sizeof(NodeRecord));
+    out.write((const char*) edges.data(), edges.size() * sizeof(uint64_t));
+    out.write(typeNames.data(), typeNames.size());
+    out.write(padding, header.payloadOffset - header.typesOffset - typeNames.size());
+    out.write(payload.data(), payload.size());
+
+    if(!out) {
+      std::cout << "Warning: failed to write checkpoint " << tmpPath << std::endl;
+      return false;
+    }
+  }
+
+  if(std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    std::cout << "Warning: failed to rename checkpoint to " << path << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool Collector::Restore(const std::string& path, std::vector< RootPtr<Collectable> >& roots) {
+
+  using namespace boost::interprocess;
+
+  // Restored nodes are registered directly, so
+  // the collecting process wouldn't see them.
+  if(_InWorker()) {
+    std::cout << "Warning: only the process which created the SharedHeap can restore" << std::endl;
+    return false;
+  }
+
+  file_mapping file;
+  mapped_region region;
+
+  try {
+    file_mapping(path.c_str(), read_only).swap(file);
+    mapped_region(file, read_only).swap(region);
+  } catch(const interprocess_exception& e) {
+    std::cout << "Warning: can't map checkpoint " << path << ": " << e.what() << std::endl;
+    return false;
+  }
+
+  const char* data = static_cast<const char*>(region.get_address());
+  uint64_t size = region.get_size();
+
+  if(size < sizeof(FileHeader)) {
+    return false;
+  }
+
+  const FileHeader& header = *reinterpret_cast<const FileHeader*>(data);
+
+  if(memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != Version) {
+    std::cout << "Warning: " << path << " isn't a checkpoint" << std::endl;
+    return false;
+  }
+
+  // The sections come in order within the file. Counts are
+  // checked against the space they have, so nothing wraps.
+  if(header.nodesOffset < sizeof(FileHeader) || header.nodesOffset % 8 != 0 ||
+     header.edgesOffset % 8 != 0 ||
+     header.nodesOffset > header.edgesOffset ||
+     header.edgesOffset > header.typesOffset ||
+     header.typesOffset > header.payloadOffset ||
+     header.payloadOffset > size ||
+     header.nodeCount > (header.edgesOffset - header.nodesOffset) / sizeof(NodeRecord) ||
+     header.edgeCount > (header.typesOffset - header.edgesOffset) / sizeof(uint64_t) ||
+     header.payloadSize > size - header.payloadOffset) {
+    std::cout << "Warning: checkpoint " << path << " is truncated" << std::endl;
+    return false;
+  }
+
+  const NodeRecord* records = reinterpret_cast<const NodeRecord*>(data + header.nodesOffset);
+  const uint64_t* edges = reinterpret_cast<const uint64_t*>(data + header.edgesOffset);
+  const char* payload = data + header.payloadOffset;
+
+  // Resolve type names against the registry.
+  std::vector<Collectable* (*)()> creators;
+
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+
+    const char* p = data + header.typesOffset;
+    const char* end = data + header.payloadOffset;
+
+    for(uint32_t i = 0; i < header.typeCount; ++i) {
+
+      uint32_t length = 0;
+      if(p + sizeof(length) > end) {
+        return false;
+      }
+      memcpy(&length, p, sizeof(length));
+      p += sizeof(length);
+
+      if(p + length > end) {
+        return false;
+      }
+      std::string name(p, length);
+      p += length;
+
+      auto iter = std::find_if(_types.begin(), _types.end(),
+                               [&name](const TypeInfo& info) { return info.name == name; });
+
+      if(iter == _types.end()) {
+        std::cout << "Warning: checkpoint type " << name << " isn't registered" << std::endl;
+        return false;
+      }
+
+      creators.push_back(iter->create);
+    }
+  }
+
+  for(uint64_t i = 0; i < header.nodeCount; ++i) {
+    const NodeRecord& record = records[i];
+    if(record.type >= creators.size() ||
+       record.edgeBegin > record.edgeEnd || record.edgeEnd > header.edgeCount ||
+       record.payloadOffset > header.payloadSize ||
+       record.payloadSize > header.payloadSize - record.payloadOffset) {
+      std::cout << "Warning: checkpoint " << path << " is corrupt" << std::endl;
+      return false;
+    }
+  }
+
+  for(uint64_t i = 0; i < header.edgeCount; ++i) {
+    if(edges[i] >= header.nodeCount) {
+      std::cout << "Warning: checkpoint " << path << " is corrupt" << std::endl;
+      return false;
+    }
+  }
+
+  // Create all the nodes first so edges can be resolved.
+  std::vector<Collectable*> nodes(size_t(header.nodeCount));
+
+  for(size_t i = 0; i < nodes.size(); ++i) {
+    nodes[i] = creators[records[i].type]();
+  }
+
+  for(size_t i = 0; i < nodes.size(); ++i) {
+    const NodeRecord& record = records[i];
+    CheckpointReader reader(nodes, payload + record.payloadOffset, size_t(record.payloadSize));
+    nodes[i]->GCLoad(reader);
+  }
+
+  // Register everything directly rather than
+  // by pushing events.
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+
+    std::vector<NodeId> ids(nodes.size());
+
+    for(size_t i = 0; i < nodes.size(); ++i) {
+      ids[i] = _Register(nodes[i]);
+    }
+
+    for(size_t i = 0; i < nodes.size(); ++i) {
+
+      const NodeRecord& record = records[i];
+      NodeInfo& info = _info[ids[i]];
+
+      info.connections.reserve(size_t(record.edgeEnd - record.edgeBegin));
+      for(uint64_t e = record.edgeBegin; e < record.edgeEnd; ++e) {
+        info.connections.push_back(ids[size_t(edges[e])]);
+
+        if(_targetBudget) {
+          _referrers[ids[size_t(edges[e])]].push_back(ids[i]);
+        }
+      }
+
+      // Hold former roots until the caller's
+      // RootPtrs are registered below.
+      if(record.rootCount) {
+        info.rootCount++;
+      }
+
+      info.tracked = true;
+    }
+
+    _liveNodes += nodes.size();
+
+    _graphChanged = true;
+  }
+
+  for(size_t i = 0; i < nodes.size(); ++i) {
+    if(records[i].rootCount) {
+      roots.push_back(RootPtr<Collectable>(nodes[i]));
+      RemoveRoot(nodes[i]);
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,96 @@
+//
+//  Checkpoint.h
+//
+//  Serialization of the collected object graph, so
+//  a process can warm-restart from a file instead
+//  of rebuilding its graph.
+//
+
+#ifndef __Dev__Checkpoint__
+#define __Dev__Checkpoint__
+
+#include "Collector.hpp"
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+// Passed to Collectable::GCSave. Writes an
+// object's state into the checkpoint payload.
+class CheckpointWriter {
+
+public:
+
+  void Write(const void* data, size_t size);
+
+  // Write a plain old data value.
+  template<class T>
+  void Write(const T& value) { Write(&value, sizeof(T)); }
+
+  void WriteString(const std::string& str);
+
+  // Write a reference to another collected node.
+  template<class T>
+  void WriteEdge(const EdgePtr<T>& edge) { _WriteNode(edge.Get()); }
+
+private:
+
+  friend class Collector;
+
+  typedef std::unordered_map<Collectable*, uint64_t> IndexMap;
+
+  CheckpointWriter(const IndexMap& indices, std::vector<char>& buffer)
+  : _indices(&indices), _indicesById(0), _buffer(buffer) { }
+
+  // For cloning, where the nodes are looked up
+  // by their collector ids instead.
+  CheckpointWriter(const std::vector<uint32_t>& indicesById, std::vector<char>& buffer)
+  : _indices(0), _indicesById(&indicesById), _buffer(buffer) { }
+
+  void _WriteNode(Collectable* node);
+
+  const IndexMap* _indices;
+  const std::vector<uint32_t>* _indicesById;
+  std::vector<char>& _buffer;
+
+};
+
+// Passed to Collectable::GCLoad. Reads back
+// what GCSave wrote, in the same order.
+class CheckpointReader {
+
+public:
+
+  void Read(void* data, size_t size);
+
+  // Read a plain old data value.
+  template<class T>
+  void Read(T& value) { Read(&value, sizeof(T)); }
+
+  std::string ReadString();
+
+  // Read a reference to another collected node.
+  // The connection is already registered with the
+  // collector, so this doesn't generate an event.
+  template<class T>
+  void ReadEdge(EdgePtr<T>& edge) {
+    assert(edge._ptr == 0);
+    edge._ptr = static_cast<T*>(_ReadNode());
+  }
+
+private:
+
+  friend class Collector;
+
+  CheckpointReader(const std::vector<Collectable*>& nodes, const char* data, size_t size)
+  : _nodes(nodes), _data(data), _size(size), _offset(0) { }
+
+  Collectable* _ReadNode();
+
+  const std::vector<Collectable*>& _nodes;
+  const char* _data;
+  size_t _size;
+  size_t _offset;
+
+};
+
+#endif /* defined(__Dev__Checkpoint__) */
@@ -0,0 +1,185 @@
+//
+//  Clone.cpp
+//
+//  Copies subgraphs using the checkpoint hooks,
+//  registering the copies in bulk.
+//
+
+#include "Checkpoint.hpp"
+#include <iostream>
+
+Collectable* Collector::_CloneSubgraph(Collectable* root, const std::function<bool(Collectable*)>& shared) {
+
+  if(! root) {
+    return 0;
+  }
+
+  // The copies are registered directly, so
+  // the collecting process wouldn't see them.
+  if(_InWorker()) {
+    std::cout << "Warning: only the process which created the SharedHeap can clone" << std::endl;
+    return 0;
+  }
+
+  // The nodes to copy, in the order they were found,
+  // and the shared nodes they point at.
+  std::vector<Collectable*> originals;
+  std::vector<Collectable*> sharedNodes;
+
+  std::vector<Collectable* (*)()> creators;
+  std::vector<char> payload;
+  std::vector<size_t> payloadOffsets;
+
+  // Edge targets, as indices into originals followed
+  // by sharedNodes, and where each node's start.
+  std::vector<NodeId> edges;
+  std::vector<size_t> edgeOffsets;
+
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+
+    _ProcessEvents();
+
+    if(root->gcId == NoId) {
+      std::cout << "Warning: can't clone a node the collector hasn't seen" << std::endl;
+      return 0;
+    }
+
+    if(_cloneIndices.size() < _nodes.size()) {
+      _cloneIndices.resize(_nodes.size(), NoId);
+    }
+
+    _cloneIndices[root->gcId] = 0;
+    originals.push_back(root);
+
+    for(size_t i = 0; i < originals.size(); ++i) {
+      for(auto adj : _info[originals[i]->gcId].connections) {
+
+        if(_cloneIndices[adj] != NoId) {
+          continue;
+        }
+
+        Collectable* node = _nodes[adj];
+
+        // Numbered after the copies, below.
+        if(shared && shared(node)) {
+          _cloneIndices[adj] = NodeId(sharedNodes.size());
+          sharedNodes.push_back(node);
+        } else {
+          _cloneIndices[adj] = NodeId(originals.size());
+          originals.push_back(node);
+        }
+      }
+    }
+
+    for(auto node : sharedNodes) {
+      _cloneIndices[node->gcId] += NodeId(originals.size());
+    }
+
+    CheckpointWriter writer(_cloneIndices, payload);
+
+    // Nodes mostly come in runs of the same type.
+    const std::type_info* lastType = 0;
+    Collectable* (*create)() = 0;
+
+    for(auto node : originals) {
+
+      if(! lastType || typeid(*node) != *lastType) {
+
+        auto type = _typeIndices.find(typeid(*node));
+
+        if(type == _typeIndices.end()) {
+          std::cout << "Warning: can't clone unregistered type "
+                    << typeid(*node).name() << std::endl;
+          create = 0;
+          break;
+        }
+
+        lastType = &typeid(*node);
+        create = _types[type->second].create;
+      }
+
+      creators.push_back(create);
+
+      payloadOffsets.push_back(payload.size());
+      node->GCSave(writer);
+
+      edgeOffsets.push_back(edges.size());
+      for(auto adj : _info[node->gcId].connections) {
+        edges.push_back(_cloneIndices[adj]);
+      }
+    }
+
+    for(auto node : originals) {
+      _cloneIndices[node->gcId] = NoId;
+    }
+
+    for(auto node : sharedNodes) {
+      _cloneIndices[node->gcId] = NoId;
+    }
+
+    if(! create) {
+      return 0;
+    }
+
+    payloadOffsets.push_back(payload.size());
+    edgeOffsets.push_back(edges.size());
+  }
+
+  // Create the copies outside the lock, like Restore,
+  // since their constructors may use the collector.
+  std::vector<Collectable*> nodes(originals.size());
+
+  for(size_t i = 0; i < nodes.size(); ++i) {
+    nodes[i] = creators[i]();
+  }
+
+  nodes.insert(nodes.end(), sharedNodes.begin(), sharedNodes.end());
+
+  for(size_t i = 0; i < originals.size(); ++i) {
+    CheckpointReader reader(nodes, payload.data() + payloadOffsets[i],
+                            payloadOffsets[i + 1] - payloadOffsets[i]);
+    nodes[i]->GCLoad(reader);
+  }
+
+  {
+    boost::mutex::scoped_lock lock(_mutex);
+
+    std::vector<NodeId> ids(nodes.size());
+
+    for(size_t i = 0; i < originals.size(); ++i) {
+      ids[i] = _Register(nodes[i]);
+    }
+
+    // The shared nodes are still reachable from root,
+    // but may have been renumbered meanwhile.
+    for(size_t i = originals.size(); i < nodes.size(); ++i) {
+      ids[i] = nodes[i]->gcId;
+    }
+
+    for(size_t i = 0; i < originals.size(); ++i) {
+
+      NodeInfo& info = _info[ids[i]];
+
+      info.connections.reserve(info.connections.size() + edgeOffsets[i + 1] - edgeOffsets[i]);
+      for(size_t e = edgeOffsets[i]; e < edgeOffsets[i + 1]; ++e) {
+        info.connections.push_back(ids[edges[e]]);
+
+        if(_targetBudget) {
+          _referrers[ids[edges[e]]].push_back(ids[i]);
+        }
+      }
+
+      if(! info.tracked) {
+        info.tracked = true;
+        _liveNodes++;
+      }
+    }
+
+    _info[ids[0]].rootCount++;
+
+    _graphChanged = true;
+  }
+
+  return nodes[0];
+}
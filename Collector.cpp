@@ -5,26 +5,205 @@
 //
 
 #include "Collector.hpp"
+#include <algorithm>
+#include <iostream>
+#include <unistd.h>
+
+const Collector::NodeId Collector::NoId;
+
+CollectableHeap* Collectable::heap = 0;
+
+void* Collectable::operator new(size_t size) {
+  
+  if(heap) {
+    if(void* p = heap->Allocate(size)) {
+      return p;
+    }
+    throw std::bad_alloc();
+  }
+  
+  return ::operator new(size);
+}
+
+void* Collectable::operator new(size_t size, const std::nothrow_t&) noexcept {
+  
+  if(heap) {
+    return heap->Allocate(size);
+  }
+  
+  return ::operator new(size, std::nothrow);
+}
+
+void Collectable::operator delete(void* p) {
+  
+  // Objects from before the heap was
+  // installed are still global.
+  if(heap && heap->Deallocate(p)) {
+    return;
+  }
+  
+  ::operator delete(p);
+}
+
+// A bounded multi-producer queue of events, in the
+// shared heap. Each cell's sequence number says whether
+// it's ready to be written or read for a given position,
+// so producers in different processes only contend on
+// claiming a position.
+struct Collector::SharedRing {
+  
+  struct Cell {
+    std::atomic<size_t> sequence;
+    Event event;
+  };
+  
+  Cell* cells;
+  size_t mask;
+  
+  // The process which created the ring, and
+  // the only one which may read it.
+  pid_t collector;
+  
+  // On separate cache lines, since the collector
+  // reads while the workers write.
+  char padding0[64];
+  std::atomic<size_t> enqueuePos;
+  char padding1[64];
+  std::atomic<size_t> dequeuePos;
+  
+};
+
+bool Collector::_CreateSharedRing(CollectableHeap& heap, size_t size) {
+  
+  void* ringMemory = heap.Allocate(sizeof(SharedRing));
+  void* cellMemory = heap.Allocate(size * sizeof(SharedRing::Cell));
+  
+  if(! ringMemory || ! cellMemory) {
+    return false;
+  }
+  
+  SharedRing* ring = new (ringMemory) SharedRing;
+  ring->cells = static_cast<SharedRing::Cell*>(cellMemory);
+  ring->mask = size - 1;
+  ring->collector = getpid();
+  ring->enqueuePos = 0;
+  ring->dequeuePos = 0;
+  
+  for(size_t i = 0; i < size; ++i) {
+    new (&ring->cells[i].sequence) std::atomic<size_t>(i);
+  }
+  
+  // Events queued before now stay in the local queue,
+  // which the collector drains first.
+  _sharedRing = ring;
+  
+  return true;
+}
+
+bool Collector::_PushShared(const Event& e) {
+  
+  SharedRing& ring = *_sharedRing;
+  size_t pos = ring.enqueuePos.load(std::memory_order_relaxed);
+  SharedRing::Cell* cell;
+  
+  for(;;) {
+    
+    cell = &ring.cells[pos & ring.mask];
+    size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+    
+    if(diff == 0) {
+      if(ring.enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if(diff < 0) {
+      // Full.
+      return false;
+    } else {
+      pos = ring.enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+  
+  cell->event = e;
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  
+  return true;
+}
+
+bool Collector::_PopShared(Event& e) {
+  
+  // Only the collecting process reads events.
+  // _ProcessEvents checks too.
+  assert(getpid() == _sharedRing->collector);
+  
+  SharedRing& ring = *_sharedRing;
+  size_t pos = ring.dequeuePos.load(std::memory_order_relaxed);
+  SharedRing::Cell* cell = &ring.cells[pos & ring.mask];
+  
+  size_t sequence = cell->sequence.load(std::memory_order_acquire);
+  
+  if(sequence != pos + 1) {
+    // Empty.
+    return false;
+  }
+  
+  ring.dequeuePos.store(pos + 1, std::memory_order_relaxed);
+  
+  e = cell->event;
+  cell->sequence.store(pos + ring.mask + 1, std::memory_order_release);
+  
+  return true;
+}
+
+bool Collector::_InWorker() const {
+  return _sharedRing && getpid() != _sharedRing->collector;
+}
 
 Collector& Collector::GetInstance() {
   static Collector collector;
   return collector;
 }
 
-Collector::Collector() : _eventQueue(32000), _sequence(0), _graphChanged(false) { }
+Collector::Collector() : _eventQueue(32000), _liveNodes(0), _sequence(0), _graphChanged(false), _sharedRing(0),
+                         _reportCycles(false), _maxCyclePatterns(10),
+                         _markedEdges(0), _metricsInterval(15), _attributeDomains(false),
+                         _shapeInterval(0), _shapeHistory(64), _marksSinceSample(0), _maxMarkStack(0),
+                         _renumberInterval(0), _marksSinceRenumber(0), _recordMarkOrder(false),
+                         _targetBudget(0), _candidatesComplete(false) {
+  _containersChanged = false;
+  _eventsPushed = 0;
+  _eventsPopped = 0;
+  _iterations = 0;
+  _loadEpoch = 0;
+  _activeLoads[0] = 0;
+  _activeLoads[1] = 0;
+  std::fill(_sampledEvents, _sampledEvents + 4, 0);
+}
 
 void Collector::_PushEvent(const Event& e) {
   
+  if(_sharedRing) {
+    while(!_PushShared(e)) {
+      std::cout << "Warning: shared collector queue is full" << std::endl;
+    }
+    return;
+  }
+  
+  // Counted first, so the collector never sees
+  // more pops than pushes.
+  _eventsPushed.fetch_add(1, std::memory_order_relaxed);
+  
   while(!_eventQueue.push(e)) {
     std::cout << "Warning: collector queue is full" << std::endl;
   }
   
 }
 
-void Collector::AddRoot(Collectable* node) {
+void Collector::AddRoot(Collectable* node, unsigned domain) {
     
   Event e;
   e.type = Event::AddRoot;
+  e.domain = domain;
   e.a = node;
   
   _PushEvent(e);
@@ -67,43 +246,172 @@ void Collector::ProcessEvents() {
   
 }
 
-void Collector::_ProcessEvents() {
+bool Collector::_BeginIteration(std::vector<Collectable*>& nodes) {
+  
+  boost::mutex::scoped_lock lock(_mutex);
+  
+  if(_InWorker()) {
+    std::cout << "Warning: only the process which created the SharedHeap can iterate over nodes" << std::endl;
+    return false;
+  }
+  
+  _ProcessEvents();
+  
+  nodes.reserve(_liveNodes);
+  
+  for(NodeId id = 0; id < _nodes.size(); ++id) {
+    if(_info[id].tracked) {
+      nodes.push_back(_nodes[id]);
+    }
+  }
+  
+  // Counted under the lock, so a Collect in progress
+  // finishes first, and later ones see it. Last, so
+  // it's only counted if nothing above threw.
+  _iterations++;
+  
+  return true;
+}
+
+Collector::NodeId Collector::_Register(Collectable* node) {
+  
+  if(node->gcId == NoId) {
+    
+    NodeId id;
+    
+    if(! _freeIds.empty()) {
+      id = _freeIds.back();
+      _freeIds.pop_back();
+    } else {
+      id = NodeId(_nodes.size());
+      _nodes.push_back(0);
+      _info.push_back(NodeInfo());
+      
+      if(_targetBudget) {
+        _referrers.push_back(std::vector<NodeId>());
+      }
+    }
+    
+    _nodes[id] = node;
+    node->gcId = id;
+  }
+  
+  return node->gcId;
+}
+
+void Collector::_ProcessEvents(std::vector<NodeId>* grey) {
   
   Event e;
   
-  while(_eventQueue.pop(e)) {
+  // Workers leave the ring to the collecting process.
+  bool shared = _sharedRing && ! _InWorker();
+  
+  // A push may be counted before its event can be
+  // popped, so this can be one high per mutator.
+  size_t depth = _eventsPushed.load(std::memory_order_relaxed) - _eventsPopped;
+  
+  if(shared) {
+    depth += _sharedRing->enqueuePos.load(std::memory_order_relaxed) -
+             _sharedRing->dequeuePos.load(std::memory_order_relaxed);
+  }
+  
+  _stats.maxQueueDepth = std::max(_stats.maxQueueDepth, depth);
+  
+  for(;;) {
+    
+    if(_eventQueue.pop(e)) {
+      _eventsPopped++;
+    } else if(! shared || ! _PopShared(e)) {
+      break;
+    }
+    
+    _stats.events[e.type]++;
     
     _graphChanged = true;
     
     switch (e.type) {
       case Event::AddRoot: {
-        _nodes.insert(e.a);
-        e.a->gcRootCount++;
+        
+        NodeId id = _Register(e.a);
+        NodeInfo& info = _info[id];
+        
+        if(! info.tracked) {
+          info.tracked = true;
+          _liveNodes++;
+        }
+        
+        info.rootCount++;
+        
+        // Untagged roots, like RootPtrs on the stack,
+        // don't change a node's domain.
+        if(e.domain != NoDomain) {
+          if(info.rootDomain == NoDomain) {
+            info.rootDomain = e.domain;
+          } else if(info.rootDomain != e.domain) {
+            info.rootDomain = SharedDomain;
+          }
+        }
+        
+        if(grey) {
+          grey->push_back(id);
+        }
       }
       break;
       case Event::RemoveRoot: {
         
-        e.a->gcRootCount--;
+        assert(e.a->gcId != NoId);
+        NodeInfo& info = _info[e.a->gcId];
+        
+        info.rootCount--;
         
         // Root count must be positive.
-        assert(e.a->gcRootCount >= 0);
+        assert(info.rootCount >= 0);
+        
+        if(info.rootCount == 0) {
+          info.rootDomain = NoDomain;
+          _AddCandidate(e.a->gcId, grey != 0);
+        }
       }
         break;
       case Event::Connect: {
         
-        e.a->gcConnections.push_back(e.b);
+        // Constructors connect a node before it's
+        // wrapped in its first RootPtr.
+        NodeId a = _Register(e.a);
+        NodeId b = _Register(e.b);
+        
+        _info[a].connections.push_back(b);
+        
+        if(_targetBudget) {
+          _referrers[b].push_back(a);
+        }
+        
+        if(grey) {
+          grey->push_back(b);
+          
+          // Kept by the mark whether or not a is live.
+          _AddCandidate(b, true);
+        }
       }
         break;
       case Event::Disconnect: {
         
-        std::vector<Collectable*>& adj = e.a->gcConnections;
+        assert(e.a->gcId != NoId && e.b->gcId != NoId);
+        std::vector<NodeId>& adj = _info[e.a->gcId].connections;
         
-        auto iter = std::find(adj.begin(), adj.end(), e.b);
+        auto iter = std::find(adj.begin(), adj.end(), e.b->gcId);
         
         // The connection must exist.
-        assert(iter != e.a->gcConnections.end());
+        assert(iter != adj.end());
         
         adj.erase(iter);
+        
+        if(_targetBudget) {
+          std::vector<NodeId>& referrers = _referrers[e.b->gcId];
+          referrers.erase(std::find(referrers.begin(), referrers.end(), e.a->gcId));
+        }
+        
+        _AddCandidate(e.b->gcId, grey != 0);
       }
         break;
         
@@ -118,6 +426,13 @@ void Collector::Collect() {
   
   boost::mutex::scoped_lock lock(_mutex);
   
+  if(_InWorker()) {
+    std::cout << "Warning: only the process which created the SharedHeap can collect" << std::endl;
+    return;
+  }
+  
+  auto start = std::chrono::steady_clock::now();
+  
   if(! _inGC.get()) {
     _inGC.reset(new bool);
   }
@@ -126,55 +441,330 @@ void Collector::Collect() {
   
   _ProcessEvents();
     
-  if(_graphChanged) {
+  // Nothing can be freed while ForEachLive is
+  // visiting, so leave marking till it's done.
+  bool deferred = _iterations != 0;
+  
+  bool containersChanged = ! deferred && _containersChanged.exchange(false);
+  
+  bool mark = ! deferred && (_graphChanged || containersChanged);
+  
+  // Events processed while marking set this again.
+  if(! deferred) {
+    _graphChanged = false;
+  }
+  
+  // Domain attribution, shape samples and renumbering
+  // are done while marking, so don't skip one they need.
+  bool markNeeded = _attributeDomains ||
+                    (_shapeInterval && _marksSinceSample + 1 >= _shapeInterval) ||
+                    (_renumberInterval && _marksSinceRenumber + 1 >= _renumberInterval);
+  
+  if(mark && _targetBudget && _candidatesComplete && ! containersChanged && ! markNeeded &&
+     _CandidatesReachable()) {
+    mark = false;
+    _candidates.clear();
+    _stats.skippedMarks++;
+    
+    // Nothing became garbage, so every node is live.
+    _stats.liveNodes = _liveNodes;
+  }
   
-    _sequence++;
+  if(mark) {
+    
+    // Candidates from before the mark are settled by it.
+    size_t settled = _candidates.size();
+    
+    _recordMarkOrder = _renumberInterval && ++_marksSinceRenumber >= _renumberInterval;
+    
+    _Mark();
     
-    std::vector<Collectable*> nodeStack;
+    // Sweep.
+    std::vector<NodeId> garbage;
+    std::map<unsigned, DomainUsage> usage;
     
-    // Traverse starting with roots.
-    for (auto node : _nodes) {
+    for(NodeId id = 0; id < _nodes.size(); ++id) {
+      
+      const NodeInfo& info = _info[id];
+      
+      if(! info.tracked) {
+        continue;
+      }
       
-      if(node->gcRootCount) {
-        nodeStack.push_back(node);
+      // Not visited.
+      if (info.sequence != _sequence) {
+        garbage.push_back(id);
+      } else if(_attributeDomains) {
+        DomainUsage& domain = usage[info.domain];
+        domain.nodes++;
+        domain.bytes += _SizeOf(_nodes[id]);
       }
     }
     
-    // Mark.
-    while(! nodeStack.empty()) {
+    if(_attributeDomains) {
+      _domainUsage.swap(usage);
+    }
+    
+    if(_reportCycles && ! garbage.empty()) {
+      _ReportCycles(garbage);
+    }
+    
+    if(_targetBudget) {
+      _DropReferrers(garbage);
+    }
+    
+    std::vector<Collectable*> freeing;
+    freeing.reserve(garbage.size());
+    
+    for(auto id : garbage) {
+      freeing.push_back(_nodes[id]);
+      _nodes[id] = 0;
+      _info[id] = NodeInfo();
+      _freeIds.push_back(id);
+    }
+    
+    _liveNodes -= garbage.size();
+    
+    if(! freeing.empty()) {
       
-      Collectable* node = nodeStack.back();
-      nodeStack.pop_back();
+      boost::mutex::scoped_lock registryLock(_registryMutex);
       
-      if(node->gcSequence != _sequence) {
-        node->gcSequence = _sequence;
-        
-        for(auto adj : node->gcConnections) {
-          nodeStack.push_back(adj);
-        }
+      // Only registries need it sorted.
+      if(! _registries.empty()) {
+        std::sort(freeing.begin(), freeing.end());
+      }
+      
+      for(auto registry : _registries) {
+        registry->GCFreeing(freeing);
       }
     }
     
-    // Sweep.
-    std::set<Collectable*> newNodes;
+    for(auto node : freeing) {
+      delete node;
+    }
+    
+    if(_shapeInterval && ++_marksSinceSample >= _shapeInterval) {
+      _marksSinceSample = 0;
+      _SampleShape();
+    }
     
-    for(auto node : _nodes) {
+    _candidates.erase(_candidates.begin(), _candidates.begin() + settled);
+    _candidatesComplete = _targetBudget != 0;
+    
+    if(_recordMarkOrder) {
+      _marksSinceRenumber = 0;
+      _recordMarkOrder = false;
+      _Renumber();
+    }
+    
+    _stats.liveNodes = _liveNodes;
+    _stats.liveEdges = _markedEdges;
+    _stats.freedNodes += garbage.size();
+    
+    size_t bucket = 0;
+    while(bucket < CollectorStats::FreedBuckets - 1 &&
+          garbage.size() > CollectorStats::FreedBounds[bucket]) {
+      ++bucket;
+    }
+    _stats.freedCounts[bucket]++;
+    
+  }
+  
+  *_inGC = false;
+  
+  auto end = std::chrono::steady_clock::now();
+  double pause = std::chrono::duration<double>(end - start).count();
+  
+  _stats.collections++;
+  _stats.pauseSeconds += pause;
+  
+  size_t bucket = 0;
+  while(bucket < CollectorStats::PauseBuckets - 1 &&
+        pause > CollectorStats::PauseBounds[bucket]) {
+    ++bucket;
+  }
+  _stats.pauseCounts[bucket]++;
+  
+  if(! _metricsPath.empty() &&
+     std::chrono::duration<double>(end - _lastMetricsWrite).count() >= _metricsInterval) {
+    _lastMetricsWrite = end;
+    _WriteMetrics();
+  }
+  
+}
+
+void Collector::_Mark() {
+  
+  _sequence++;
+  _markedEdges = 0;
+  _maxMarkStack = 0;
+  
+  std::vector<NodeId> nodeStack;
+  
+  if(_attributeDomains) {
+    _MarkDomains(nodeStack);
+  } else {
+    
+    // Traverse starting with roots, pushed in reverse
+    // so the lowest id is visited first, which keeps
+    // the order _Renumber sets up.
+    for (NodeId id = NodeId(_nodes.size()); id-- > 0; ) {
       
-      // Not visited.
-      if (node->gcSequence != _sequence) {
-        delete node;
-      } else {
-        newNodes.insert(node);
+      if(_info[id].rootCount) {
+        nodeStack.push_back(id);
       }
     }
     
-    _nodes.swap(newNodes);
+    // Trace the root containers. An element removed from a
+    // container since the events were processed had to be
+    // held by a RootPtr first, which the second pass of
+    // events below picks up.
+    {
+      boost::mutex::scoped_lock lock(_containerMutex);
+      
+      for(auto container : _containers) {
+        _TraceContainer(container, nodeStack);
+      }
+    }
     
-    _graphChanged = false;
+    _MarkFrom(nodeStack);
+  }
+  
+  // Elements added to containers since the events were
+  // processed may since have lost their other references,
+  // as may pointers loaded from AtomicEdgePtrs. Process
+  // events again, keeping the targets of new roots and
+  // edges, so nothing escapes the mark.
+  _WaitForLoads(nodeStack);
+  _ProcessEvents(&nodeStack);
+  
+  if(_attributeDomains) {
+    _MarkFrom(nodeStack, NoDomain);
+  } else {
+    _MarkFrom(nodeStack);
+  }
+  
+}
+
+void Collector::_TraceContainer(RootContainer* container, std::vector<NodeId>& nodeStack) {
+  
+  std::vector<Collectable*> held;
+  container->GCTrace(held);
+  
+  for(auto node : held) {
+    if(node->gcId != NoId) {
+      nodeStack.push_back(node->gcId);
+    }
+  }
+  
+}
+
+void Collector::_MarkFrom(std::vector<NodeId>& nodeStack) {
+  
+  while(! nodeStack.empty()) {
+    
+    _maxMarkStack = std::max(_maxMarkStack, nodeStack.size());
     
+    NodeId id = nodeStack.back();
+    nodeStack.pop_back();
+    
+    NodeInfo& info = _info[id];
+    
+    if(info.sequence != _sequence) {
+      info.sequence = _sequence;
+      _markedEdges += info.connections.size();
+      
+      if(_recordMarkOrder) {
+        _markOrder.push_back(id);
+      }
+      
+      nodeStack.insert(nodeStack.end(), info.connections.begin(), info.connections.end());
+    }
   }
   
-  *_inGC = false;
+}
+
+size_t Collector::BeginLoad() {
+  
+  for(;;) {
+    
+    size_t epoch = _loadEpoch;
+    _activeLoads[epoch & 1]++;
+    
+    // Only count the load if it was registered before
+    // the collector moved on to the next epoch.
+    if(_loadEpoch == epoch) {
+      return epoch;
+    }
+    
+    _activeLoads[epoch & 1]--;
+  }
   
 }
 
+void Collector::_WaitForLoads(std::vector<NodeId>& grey) {
+  
+  size_t epoch = _loadEpoch++;
+  
+  // A load can be stuck pushing its AddRoot onto a full
+  // queue, so keep draining while waiting.
+  while(_activeLoads[epoch & 1] != 0) {
+    _ProcessEvents(&grey);
+    boost::this_thread::yield();
+  }
+  
+}
+
+void Collector::AddRootContainer(RootContainer* container) {
+  
+  boost::mutex::scoped_lock lock(_containerMutex);
+  
+  _containers.insert(container);
+  
+}
+
+void Collector::RemoveRootContainer(RootContainer* container) {
+  
+  boost::mutex::scoped_lock lock(_containerMutex);
+  
+  _containers.erase(container);
+  _containersChanged = true;
+  
+}
+
+void Collector::AddFinalizationRegistry(FinalizationRegistryBase* registry) {
+  
+  boost::mutex::scoped_lock lock(_registryMutex);
+  
+  _registries.insert(registry);
+  
+}
+
+void Collector::RemoveFinalizationRegistry(FinalizationRegistryBase* registry) {
+  
+  boost::mutex::scoped_lock lock(_registryMutex);
+  
+  _registries.erase(registry);
+  
+}
+
+void Collector::_RegisterType(const std::type_info& type, const std::string& name,
+                              size_t size, Collectable* (*create)()) {
+  
+  boost::mutex::scoped_lock lock(_mutex);
+  
+  TypeInfo info;
+  info.name = name;
+  info.size = size;
+  info.create = create;
+  
+  auto iter = _typeIndices.find(type);
+  
+  if(iter != _typeIndices.end()) {
+    _types[iter->second] = info;
+  } else {
+    _typeIndices[type] = _types.size();
+    _types.push_back(info);
+  }
+  
+}
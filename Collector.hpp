@@ -8,37 +8,258 @@
 #ifndef __Dev__Collector__
 #define __Dev__Collector__
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <new>
 #include <set>
+#include <string>
+#include <typeindex>
 #include <vector>
 #include <boost/lockfree/queue.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/tss.hpp>
 
+class CheckpointWriter;
+class CheckpointReader;
+template<typename T> class RootPtr;
+
+// Somewhere other than the global heap to allocate
+// Collectables from. See SharedHeap.
+class CollectableHeap {
+  
+public:
+  
+  virtual ~CollectableHeap() { }
+  
+  // Returns null when it's out of space.
+  virtual void* Allocate(size_t size) = 0;
+  
+  // Returns false if p didn't come from here.
+  virtual bool Deallocate(void* p) = 0;
+  
+};
+
 // Derive from Collectable if you'd like an object
 // to be garbage collected.
 class Collectable {
   
 public:
   
-  Collectable() : gcRootCount(0), gcSequence(0) { }
+  Collectable() : gcId(~uint32_t(0)) { }
   virtual ~Collectable() { }
   
+  // A copy is a new node to the collector.
+  Collectable(const Collectable&) : gcId(~uint32_t(0)) { }
+  Collectable& operator=(const Collectable&) { return *this; }
+  
+  // Write the object's state to a checkpoint. Only
+  // needed for types registered with Collector::RegisterType.
+  virtual void GCSave(CheckpointWriter&) const { }
+  
+  // Read the object's state back from a checkpoint. Called
+  // on a default constructed object. Use
+  // CheckpointReader::ReadEdge to restore EdgePtrs.
+  virtual void GCLoad(CheckpointReader&) { }
+  
+  // Collectables come from the CollectableHeap when
+  // one has been installed, the global heap otherwise.
+  static void* operator new(size_t size);
+  static void operator delete(void* p);
+  
+  // Declaring the above hides the global forms,
+  // so bring back nothrow and placement new.
+  static void* operator new(size_t size, const std::nothrow_t&) noexcept;
+  static void operator delete(void* p, const std::nothrow_t&) noexcept { operator delete(p); }
+  
+  static void* operator new(size_t, void* p) noexcept { return p; }
+  static void operator delete(void*, void*) noexcept { }
+  
 private:
   
   friend class Collector;
+  friend class CheckpointWriter;
+  friend class SharedHeap;
+
+  // Set by SharedHeap::Create.
+  static CollectableHeap* heap;
 
-  // Connections as seen by the garbage collector.
-  std::vector<Collectable*> gcConnections;
+  // Index of the collector's side table entry for this
+  // node, which holds everything marking needs. Assigned
+  // by the collector when it first sees the node, and
+  // changed when it renumbers.
+  uint32_t gcId;
+
+};
+
+// Something which isn't collected itself but holds
+// references to many Collectables, like a registry. It
+// registers with the collector once, instead of once per
+// reference like RootPtr, and the collector traces it
+// in bulk.
+//
+// Implementations must call Collector::AddRootContainer
+// once fully constructed and RemoveRootContainer before
+// destroying anything GCTrace looks at.
+class RootContainer {
   
-  // How many times is this node referenced as
-  // a root.
-  int gcRootCount;
+public:
   
-  // Sequence number used to determine if
-  // the Collectable has been visited in the
-  // current round of GC.
-  size_t gcSequence;
+  virtual ~RootContainer() { }
+  
+  // Append the held Collectables to nodes. Called from
+  // the collector thread, concurrently with mutators,
+  // so lock against modification.
+  virtual void GCTrace(std::vector<Collectable*>& nodes) = 0;
+  
+  // Domain the held roots are tagged with. See
+  // Collector::GetDomainUsage. Untagged by default.
+  virtual unsigned GCDomain() const { return 0; }
+  
+};
 
+// Told about nodes just before Collect frees them.
+// See FinalizationRegistry.
+class FinalizationRegistryBase {
+  
+public:
+  
+  virtual ~FinalizationRegistryBase() { }
+  
+  // Called from the collector thread with the nodes
+  // about to be freed, sorted by address.
+  virtual void GCFreeing(const std::vector<Collectable*>& garbage) = 0;
+  
+};
+
+// Which cyclic structures made up the garbage in a
+// collection. See Collector::SetCycleReporting.
+struct CycleReport {
+  
+  // Strongly connected components of garbage
+  // sharing the same set of types.
+  struct Pattern {
+    
+    // Type names in the component, sorted and
+    // joined, like "Edge <-> Node".
+    std::string types;
+    
+    // Number of components.
+    size_t cycles;
+    
+    size_t nodes;
+    size_t bytes;
+  };
+  
+  size_t freedNodes;
+  size_t cyclicNodes;
+  
+  // Most bytes first.
+  std::vector<Pattern> patterns;
+  
+  CycleReport() : freedNodes(0), cyclicNodes(0) { }
+};
+
+// What the nodes attributed to a domain add up to. See
+// Collector::GetDomainUsage.
+struct DomainUsage {
+  
+  size_t nodes;
+  size_t bytes;
+  
+  DomainUsage() : nodes(0), bytes(0) { }
+};
+
+// Counters kept by the collector. See
+// Collector::SetMetricsFile.
+struct CollectorStats {
+  
+  enum {
+    PauseBuckets = 10,
+    FreedBuckets = 8
+  };
+  
+  // Upper bounds of the histogram buckets.
+  // The last is infinity.
+  static const double PauseBounds[PauseBuckets];
+  static const double FreedBounds[FreedBuckets];
+  
+  size_t collections;
+  
+  // Time spent in Collect.
+  double pauseSeconds;
+  size_t pauseCounts[PauseBuckets];
+  
+  // Events processed, by type: add root, remove
+  // root, connect, disconnect.
+  size_t events[4];
+  
+  // Most events waiting in the queue, sampled
+  // whenever the collector starts draining it.
+  size_t maxQueueDepth;
+  
+  // As of the last mark. Skipped marks update
+  // liveNodes but not liveEdges.
+  size_t liveNodes;
+  size_t liveEdges;
+  
+  size_t freedNodes;
+  size_t freedCounts[FreedBuckets];
+  
+  // Collections which skipped marking because targeted
+  // checks found nothing had become garbage. See
+  // Collector::SetTargetedChecks.
+  size_t skippedMarks;
+  
+  CollectorStats();
+};
+
+// The shape of the live graph at one collection. See
+// Collector::SetShapeProfiling.
+struct ShapeSample {
+  
+  enum {
+    Buckets = 16
+  };
+  
+  // Upper bounds of the buckets, 0, 1, 3, 7, ... doubling.
+  // The last is infinity.
+  static const double Bounds[Buckets];
+  
+  // Value of CollectorStats::collections once the
+  // collection it was taken in finished.
+  size_t collection;
+  
+  size_t nodes;
+  size_t edges;
+  
+  // Live nodes by number of connections.
+  size_t degreeCounts[Buckets];
+  size_t maxDegree;
+  
+  // Deepest the mark stack got.
+  size_t maxMarkStack;
+  
+  // Nodes held by RootPtrs, by root count, and the
+  // total count. Roots in containers aren't counted.
+  size_t rootCounts[Buckets];
+  size_t roots;
+  
+  // Events processed since the previous sample, by type:
+  // add root, remove root, connect, disconnect.
+  size_t events[4];
+  
+  ShapeSample();
+  
+  // Which bucket n goes in.
+  static size_t Bucket(size_t n);
 };
 
 // The garbage collector. A singleton.
@@ -54,8 +275,14 @@ public:
   // Get the singleton instance.
   static Collector& GetInstance();
   
+  // Domains for attributing memory. Roots are untagged
+  // unless given a domain, and nodes reachable from more
+  // than one domain are attributed to SharedDomain.
+  static const unsigned NoDomain = 0;
+  static const unsigned SharedDomain = ~0u;
+  
   // Add a reference to a root collectable.
-  void AddRoot(Collectable*);
+  void AddRoot(Collectable*, unsigned domain = NoDomain);
   
   // Remove a reference to a root collectable.
   void RemoveRoot(Collectable*);
@@ -77,6 +304,215 @@ public:
   // this from one thread at a time.
   void Collect();
   
+  // Bracket reading a pointer from a slot other threads
+  // may overwrite and queueing its AddRoot. Collect waits
+  // for loads in progress before its final pass over the
+  // events, so their roots are seen. It keeps draining the
+  // queue while it waits, so pushing events inside the
+  // bracket can't block it. See AtomicEdgePtr.
+  size_t BeginLoad();
+  void EndLoad(size_t epoch) { _activeLoads[epoch & 1]--; }
+  
+  // Register a container holding many roots. Elements
+  // must be added to the container from a RootPtr.
+  void AddRootContainer(RootContainer*);
+  
+  // Unregister a container.
+  void RemoveRootContainer(RootContainer*);
+  
+  // Tell the collector a container has dropped references,
+  // so the next Collect doesn't skip marking.
+  void RootContainerChanged() { _containersChanged = true; }
+  
+  // Register a registry to be told about freed nodes.
+  void AddFinalizationRegistry(FinalizationRegistryBase*);
+  
+  // Unregister a registry.
+  void RemoveFinalizationRegistry(FinalizationRegistryBase*);
+  
+  // Periodically write the collector's stats to path, in
+  // Prometheus text format, for node_exporter's textfile
+  // collector. Written at the end of Collect, at most every
+  // interval seconds, to a temporary file which is renamed
+  // over path. An empty path stops writing.
+  void SetMetricsFile(const std::string& path, double interval = 15);
+  
+  CollectorStats GetStats();
+  
+  // When enabled, each Collect finds the cycles among
+  // the nodes it frees and groups them by type, keeping
+  // the top maxPatterns. Type names and sizes come from
+  // RegisterType. Unregistered types use their mangled
+  // name and count as sizeof(Collectable).
+  void SetCycleReporting(bool enabled, size_t maxPatterns = 10);
+  
+  // The report from the last Collect which freed
+  // anything.
+  CycleReport GetCycleReport();
+  
+  // When enabled, each mark attributes every live node to
+  // the first domain whose roots reach it, or SharedDomain
+  // if others reach it too, at the cost of visiting shared
+  // nodes twice. Domains are marked in increasing order,
+  // then untagged roots mark whatever's left as NoDomain.
+  void SetDomainAttribution(bool enabled);
+  
+  // Live nodes and bytes by domain, as of the last Collect
+  // which marked with attribution on. Bytes come from
+  // RegisterType, or sizeof(Collectable) for unregistered
+  // types.
+  std::map<unsigned, DomainUsage> GetDomainUsage();
+  
+  // Every interval collections which mark, sample the shape
+  // of the graph: out-degrees, mark stack depth, root counts
+  // and the mix of events, keeping the last history samples.
+  // Costs an extra pass over the live nodes when sampling.
+  // An interval of 0 stops sampling.
+  void SetShapeProfiling(size_t interval, size_t history = 64);
+  
+  // Oldest first.
+  std::vector<ShapeSample> GetShapeSamples();
+  
+  // Every interval collections which mark, renumber the
+  // nodes in the order that mark visited them, so the
+  // collector's side tables are laid out in traversal
+  // order and later marks walk through them roughly
+  // sequentially. Also compacts the ids of freed nodes.
+  // An interval of 0 stops renumbering.
+  void SetRenumbering(size_t interval);
+  
+  // Before marking, check whether the nodes which lost a
+  // reference since the last mark can still be reached,
+  // by searching backwards from each, through a table of
+  // what references what, to a root. If they all can,
+  // nothing has become garbage and the mark is skipped.
+  // Gives up and marks if the searches visit more than
+  // budget nodes in all (nodes in root containers count),
+  // if more than budget references were dropped, or if
+  // a container dropped any. Suits big heaps which drop
+  // few references between collections. The table costs
+  // a vector per node and an id per edge. A budget of 0
+  // turns it off.
+  //
+  // Domain attribution, shape samples and renumbering
+  // only happen when marking, so a collection due to
+  // sample or renumber always marks, and with domain
+  // attribution on, every collection that saw events does.
+  void SetTargetedChecks(size_t budget);
+  
+  // Register a type so it can be checkpointed and
+  // restored. T must be default constructible. Call
+  // before Checkpoint or Restore.
+  template<class T>
+  void RegisterType(const std::string& name) {
+    _RegisterType(typeid(T), name, sizeof(T), &_Create<T>);
+  }
+  
+  // Write all live nodes and their connections to
+  // a file. Mutator threads should be quiescent while
+  // this runs. Returns false on failure.
+  bool Checkpoint(const std::string& path);
+  
+  // Map a checkpoint file and recreate its nodes,
+  // registering them and their connections in bulk.
+  // RootPtrs to the nodes which were roots when the
+  // checkpoint was taken are appended to roots.
+  // Returns false on failure.
+  bool Restore(const std::string& path, std::vector< RootPtr<Collectable> >& roots);
+  
+  // Copy root and everything reachable from it, saving
+  // each node with GCSave and loading a new one of the
+  // same type with GCLoad, then register the copies and
+  // their connections in bulk. Nodes shared returns true
+  // for aren't copied, and the copies point at them
+  // instead. shared is called with the collector locked,
+  // so mustn't call Collect or ProcessEvents. Types must
+  // be registered with RegisterType. Don't modify the
+  // subgraph while it's copied. Returns null on failure.
+  template<class T>
+  RootPtr<T> CloneSubgraph(const RootPtr<T>& root,
+                           std::function<bool(Collectable*)> shared = std::function<bool(Collectable*)>()) {
+    
+    Collectable* clone = _CloneSubgraph(root.Get(), shared);
+    
+    if(! clone) {
+      return RootPtr<T>();
+    }
+    
+    // Swap the root the clone was registered
+    // with for ours.
+    RootPtr<T> result(static_cast<T*>(clone));
+    RemoveRoot(clone);
+    
+    return result;
+  }
+  
+  // Call visitor(T*) on every node which is a T, splitting
+  // the nodes between parallelism threads, the calling
+  // thread being one. The visitor may be called from
+  // several threads at once. Nothing is freed until this
+  // returns, so nodes which became garbage since the last
+  // Collect may be visited too. Collects meanwhile only
+  // process events, and leave marking for later. If the
+  // visitor throws, the rest of the nodes are skipped and
+  // the first exception is rethrown here.
+  template<class T, class Visitor>
+  void ForEachLive(Visitor visitor, size_t parallelism = 1) {
+    
+    std::vector<Collectable*> nodes;
+    
+    if(! _BeginIteration(nodes)) {
+      return;
+    }
+    
+    // Threads take chunks as they go, since
+    // the Ts may be bunched up.
+    const size_t chunk = 1024;
+    std::atomic<size_t> next(0);
+    
+    std::exception_ptr error;
+    boost::mutex errorMutex;
+    
+    auto visit = [&]() {
+      try {
+        for(;;) {
+          size_t begin = next.fetch_add(chunk);
+          if(begin >= nodes.size()) {
+            break;
+          }
+          size_t end = std::min(begin + chunk, nodes.size());
+          for(size_t i = begin; i < end; ++i) {
+            if(T* node = dynamic_cast<T*>(nodes[i])) {
+              visitor(node);
+            }
+          }
+        }
+      } catch(...) {
+        boost::mutex::scoped_lock lock(errorMutex);
+        if(! error) {
+          error = std::current_exception();
+        }
+        next = nodes.size();
+      }
+    };
+    
+    parallelism = std::min(std::max(parallelism, size_t(1)), nodes.size() / chunk + 1);
+    
+    {
+      Iteration iteration(_iterations);
+      
+      for(size_t i = 1; i < parallelism; ++i) {
+        iteration.threads.create_thread(visit);
+      }
+      
+      visit();
+    }
+    
+    if(error) {
+      std::rethrow_exception(error);
+    }
+  }
+  
   // Are we in the garbage collector thread?
   bool InGC() {
     if(_inGC.get() == 0) {
@@ -101,6 +537,10 @@ private:
     };
     
     Type type;
+    
+    // For AddRoot.
+    unsigned domain;
+    
     Collectable* a;
     Collectable* b;
     
@@ -108,12 +548,152 @@ private:
   
   boost::lockfree::queue<Event, boost::lockfree::fixed_sized<true> > _eventQueue;
   
-  // All the nodes we've seen.
-  std::set<Collectable*> _nodes;
+  // Events pushed onto and popped off _eventQueue, so
+  // its depth is the difference.
+  std::atomic<size_t> _eventsPushed;
+  size_t _eventsPopped;
+  
+  typedef uint32_t NodeId;
+  static const NodeId NoId = ~NodeId(0);
+  
+  // What the collector knows about a node, kept in
+  // a table by id rather than in the node, so marking
+  // doesn't touch the nodes themselves.
+  struct NodeInfo {
+    
+    // Connections as seen by the garbage collector.
+    std::vector<NodeId> connections;
+    
+    // How many times is this node referenced as
+    // a root.
+    int rootCount;
+    
+    // Domain of the tagged roots referencing this
+    // node, if any. See GetDomainUsage.
+    unsigned rootDomain;
+    
+    // Sequence number used to determine if
+    // the node has been visited in the
+    // current round of GC.
+    size_t sequence;
+    
+    // Domain the last mark attributed this node to.
+    unsigned domain;
+    
+    // Has it ever been a root? Nodes are only swept
+    // once they have, since a node's edges can be
+    // seen before the RootPtr it's created into.
+    bool tracked;
+    
+    NodeInfo() : rootCount(0), rootDomain(0), sequence(0), domain(0), tracked(false) { }
+  };
+  
+  // All the nodes we've seen, by id. Freed nodes leave
+  // null entries, reused by new nodes or compacted
+  // away by renumbering.
+  std::vector<Collectable*> _nodes;
+  std::vector<NodeInfo> _info;
+  std::vector<NodeId> _freeIds;
+  
+  // Tracked nodes in _nodes.
+  size_t _liveNodes;
+  
+  // The node's id, giving it one if it hasn't one yet.
+  NodeId _Register(Collectable* node);
   
   void _PushEvent(const Event& e);
   
-  void _ProcessEvents();
+  // If grey is non-null, new roots and edge targets are
+  // appended to it, so a mark in progress keeps them.
+  void _ProcessEvents(std::vector<NodeId>* grey = 0);
+  
+  // Mark everything reachable from the roots
+  // with a new sequence number.
+  void _Mark();
+  
+  // Trace the root containers, appending the ids of
+  // the held nodes the collector has seen. Others have
+  // AddRoots in the queue, which marking picks up.
+  void _TraceContainer(RootContainer* container, std::vector<NodeId>& nodeStack);
+  
+  // Mark the nodes on the stack and everything
+  // reachable from them.
+  void _MarkFrom(std::vector<NodeId>& nodeStack);
+  
+  // Same, attributing newly marked nodes to domain, and
+  // nodes another domain marked to SharedDomain.
+  void _MarkFrom(std::vector<NodeId>& nodeStack, unsigned domain);
+  
+  // Loads in progress, by parity of the epoch
+  // they started in.
+  std::atomic<size_t> _loadEpoch;
+  std::atomic<size_t> _activeLoads[2];
+  
+  // Wait for loads started before now to finish,
+  // processing events onto grey meanwhile.
+  void _WaitForLoads(std::vector<NodeId>& grey);
+  
+  std::set<RootContainer*> _containers;
+  
+  // Guards _containers, and keeps them from being
+  // removed while they're traced.
+  boost::mutex _containerMutex;
+  
+  std::atomic<bool> _containersChanged;
+  
+  // ForEachLives in progress. Nothing is
+  // freed while there are any.
+  std::atomic<size_t> _iterations;
+  
+  // Process events and copy out the nodes for
+  // ForEachLive, holding off freeing until
+  // _iterations is decremented. Returns false,
+  // counting nothing, in a SharedHeap worker.
+  bool _BeginIteration(std::vector<Collectable*>& nodes);
+  
+  // Joins ForEachLive's threads and ends the iteration,
+  // however it's left, even if starting a thread threw.
+  struct Iteration {
+    
+    explicit Iteration(std::atomic<size_t>& iterations) : iterations(iterations) { }
+    
+    ~Iteration() {
+      boost::this_thread::disable_interruption noInterrupts;
+      threads.join_all();
+      iterations--;
+    }
+    
+    boost::thread_group threads;
+    std::atomic<size_t>& iterations;
+  };
+  
+  std::set<FinalizationRegistryBase*> _registries;
+  boost::mutex _registryMutex;
+  
+  // A type which can be checkpointed.
+  struct TypeInfo {
+    std::string name;
+    size_t size;
+    Collectable* (*create)();
+  };
+  
+  std::vector<TypeInfo> _types;
+  std::map<std::type_index, size_t> _typeIndices;
+  
+  void _RegisterType(const std::type_info& type, const std::string& name,
+                     size_t size, Collectable* (*create)());
+  
+  template<class T>
+  static Collectable* _Create() { return new T; }
+  
+  // The copy of root, holding a root count
+  // for the caller to take over.
+  Collectable* _CloneSubgraph(Collectable* root, const std::function<bool(Collectable*)>& shared);
+  
+  // Index in the clone in progress of each node, by id,
+  // or NoId. Kept between clones to save allocating it,
+  // and reset as each finishes.
+  std::vector<NodeId> _cloneIndices;
   
   boost::thread_specific_ptr<bool> _inGC;
   
@@ -127,6 +707,104 @@ private:
   // doing collection.
   boost::mutex _mutex;
   
+  friend class SharedHeap;
+  
+  // When there's a SharedHeap, events from all the
+  // processes sharing it go through a ring in shared
+  // memory instead of _eventQueue.
+  struct SharedRing;
+  SharedRing* _sharedRing;
+  
+  // Allocate the ring from heap, with size (a power
+  // of two) cells, and send events through it.
+  bool _CreateSharedRing(CollectableHeap& heap, size_t size);
+  
+  bool _PushShared(const Event& e);
+  bool _PopShared(Event& e);
+  
+  // Is this a worker forked after the SharedHeap was
+  // created? Its copy of the graph is stale, and events
+  // it pops never reach the collecting process.
+  bool _InWorker() const;
+  
+  bool _reportCycles;
+  size_t _maxCyclePatterns;
+  CycleReport _cycleReport;
+  
+  void _ReportCycles(const std::vector<NodeId>& garbage);
+  
+  CollectorStats _stats;
+  
+  // Edges seen by the mark in progress.
+  size_t _markedEdges;
+  
+  std::string _metricsPath;
+  double _metricsInterval;
+  std::chrono::steady_clock::time_point _lastMetricsWrite;
+  
+  void _WriteMetrics();
+  
+  bool _attributeDomains;
+  std::map<unsigned, DomainUsage> _domainUsage;
+  
+  // Mark with attribution, root domain by root domain.
+  void _MarkDomains(std::vector<NodeId>& nodeStack);
+  
+  // Bytes a node counts as in reports.
+  size_t _SizeOf(Collectable* node);
+  
+  size_t _shapeInterval;
+  size_t _shapeHistory;
+  size_t _marksSinceSample;
+  std::deque<ShapeSample> _shapeSamples;
+  
+  // Events counted as of the last sample.
+  size_t _sampledEvents[4];
+  
+  // Deepest the mark stack got in the mark in progress.
+  size_t _maxMarkStack;
+  
+  void _SampleShape();
+  
+  size_t _renumberInterval;
+  size_t _marksSinceRenumber;
+  
+  // When set, marking appends the ids it visits
+  // to _markOrder, for _Renumber.
+  bool _recordMarkOrder;
+  std::vector<NodeId> _markOrder;
+  
+  void _Renumber();
+  
+  size_t _targetBudget;
+  
+  // Referrers of each node, by id, while targeted
+  // checks are on.
+  std::vector< std::vector<NodeId> > _referrers;
+  
+  // Nodes which lost a reference since the last mark,
+  // plus ones it kept without proving them reachable.
+  std::vector<NodeId> _candidates;
+  
+  // False until a mark has run with targeted checks on,
+  // since dropped references weren't recorded before.
+  bool _candidatesComplete;
+  
+  // Record id as a candidate. Ones seen while marking are
+  // kept regardless of the budget, since the mark can't
+  // vouch for them.
+  void _AddCandidate(NodeId id, bool marking);
+  
+  // Can every candidate be reached from a root within
+  // the budget?
+  bool _CandidatesReachable();
+  
+  void _BuildReferrers();
+  
+  // Remove the garbage from the referrers of the
+  // nodes it references.
+  void _DropReferrers(const std::vector<NodeId>& garbage);
+  
 };
 
 // When passing references to Collectables
@@ -142,6 +820,14 @@ public:
     _Retain();
   }
   
+  // A root tagged with a domain. See
+  // Collector::GetDomainUsage. Copies aren't tagged.
+  RootPtr(T* ptr, unsigned domain) : _ptr(ptr) {
+    if(_ptr) {
+      Collector::GetInstance().AddRoot(_ptr, domain);
+    }
+  }
+  
   RootPtr(const RootPtr& other) : _ptr(other._ptr) {
     _Retain();
   }
@@ -218,6 +904,31 @@ std::ostream& operator<<(std::ostream& out, const RootPtr<T>& p) {
   return out << p._ptr;
 }
 
+// Deleter for shared_ptrs handed out by ToSharedPtr.
+// Releases the group's root rather than deleting.
+struct RootReleaser {
+  void operator()(Collectable* ptr) const {
+    Collector::GetInstance().RemoveRoot(ptr);
+  }
+};
+
+// Hand a Collectable to code which uses std::shared_ptr.
+// The returned shared_ptr and all its copies (and aliases)
+// share a control block which holds a single root, added
+// here and removed when the last owner goes away. Copy
+// the shared_ptr rather than calling this again, since
+// each call starts a new group.
+template<class T>
+std::shared_ptr<T> ToSharedPtr(const RootPtr<T>& p) {
+  
+  if(!p) {
+    return std::shared_ptr<T>();
+  }
+  
+  Collector::GetInstance().AddRoot(p.Get());
+  return std::shared_ptr<T>(p.Get(), RootReleaser());
+}
+
 // When passing references to Collectables
 // on the stack, always use RootPtr.
 template<typename T>
@@ -230,11 +941,32 @@ public:
     assert(owner);
   }
   
-  EdgePtr(Collectable* owner, const RootPtr<T>& other) : _owner(owner), _ptr(other._ptr) {
+  EdgePtr(Collectable* owner, const RootPtr<T>& other) : _owner(owner), _ptr(other.Get()) {
+    assert(owner);
+    _Retain();
+  }
+  
+  template<class T2>
+  EdgePtr(Collectable* owner, const RootPtr<T2>& other) : _owner(owner), _ptr(other.Get()) {
+    assert(owner);
+    _Retain();
+  }
+  
+  // Point at what another object's EdgePtr points at,
+  // without going through a RootPtr. other's owner must
+  // be kept alive meanwhile.
+  template<class T2>
+  EdgePtr(Collectable* owner, const EdgePtr<T2>& other) : _owner(owner), _ptr(other.Get()) {
     assert(owner);
     _Retain();
   }
   
+  // Copies have the same owner, so they can be kept
+  // in containers.
+  EdgePtr(const EdgePtr& other) : _owner(other._owner), _ptr(other._ptr) {
+    _Retain();
+  }
+  
   ~EdgePtr() {
 
     // If we're not in the GC thread.
@@ -267,6 +999,8 @@ public:
   // Create a RootPtr out of this EdgePtr.
   RootPtr<T> GetRootPtr() const { return RootPtr<T>(_ptr); }
   
+  T* Get() const { return _ptr; }
+  
   operator bool() const { return _ptr != 0; }
   
   bool operator==(const EdgePtr& other) const {
@@ -283,6 +1017,8 @@ public:
   
 private:
   
+  friend class CheckpointReader;
+  
   void _Retain() {
     if(_ptr) {
       Collector::GetInstance().AddEdge(_owner, _ptr);
@@ -0,0 +1,189 @@
+//
+//  ConcurrentMap.h
+//
+//  A hash map with lock-free lookups, whose
+//  entries are reclaimed by the collector.
+//
+
+#ifndef __Dev__ConcurrentMap__
+#define __Dev__ConcurrentMap__
+
+#include "AtomicEdgePtr.hpp"
+#include <deque>
+#include <functional>
+
+// A map from keys to Collectables, built out of
+// Collectables. Lookups don't take a lock. Writers are
+// serialized by a mutex, and removed entries are left for
+// Collect rather than protected by hazard pointers.
+//
+// Entries are immutable. Each bucket is a chain which
+// writers replace with copy-on-write, and lookups walk it
+// inside a LoadGuard, so the only event a lookup generates
+// is rooting the value it finds, and Get skips even that.
+template<typename K, typename V, typename Hash = std::hash<K> >
+class ConcurrentMap {
+
+public:
+
+  explicit ConcurrentMap(size_t buckets = 16) : _head(new Head), _size(0) {
+    size_t n = 1;
+    while(n < buckets) {
+      n <<= 1;
+    }
+    _head->table.store(RootPtr<Table>(new Table(n)));
+  }
+
+  // Returns a null RootPtr if key isn't there.
+  RootPtr<V> Find(const K& key) const {
+
+    LoadGuard guard;
+
+    return RootPtr<V>(Get(key));
+  }
+
+  // Like Find, but without rooting the value, so it only
+  // stays alive while the caller holds a LoadGuard. Queues
+  // no events, so lookups don't wait on the collector.
+  V* Get(const K& key) const {
+
+    Table* table = _head->table.Get();
+
+    for(Entry* entry = table->Bucket(_hash(key)).Get(); entry; entry = entry->next.Get()) {
+      if(entry->key == key) {
+        return entry->value.Get();
+      }
+    }
+
+    return 0;
+  }
+
+  // Insert or replace.
+  void Insert(const K& key, const RootPtr<V>& value) {
+
+    boost::mutex::scoped_lock lock(_writeMutex);
+
+    Table* table = _head->table.Get();
+    AtomicEdgePtr<Entry>& bucket = table->Bucket(_hash(key));
+
+    std::vector<Entry*> prefix;
+    Entry* found = _Find(bucket, key, prefix);
+
+    if(found) {
+      RootPtr<Entry> entry(new Entry(key, value, RootPtr<Entry>(found->next.Get())));
+      bucket.store(_Copy(prefix, entry));
+      return;
+    }
+
+    bucket.store(RootPtr<Entry>(new Entry(key, value, RootPtr<Entry>(bucket.Get()))));
+
+    if(++_size > 2 * table->buckets.size()) {
+      _Grow();
+    }
+  }
+
+  // Returns false if key wasn't there.
+  bool Erase(const K& key) {
+
+    boost::mutex::scoped_lock lock(_writeMutex);
+
+    AtomicEdgePtr<Entry>& bucket = _head->table.Get()->Bucket(_hash(key));
+
+    std::vector<Entry*> prefix;
+    Entry* found = _Find(bucket, key, prefix);
+
+    if(!found) {
+      return false;
+    }
+
+    bucket.store(_Copy(prefix, RootPtr<Entry>(found->next.Get())));
+    --_size;
+
+    return true;
+  }
+
+  size_t Size() const { return _size; }
+
+private:
+
+  ConcurrentMap(const ConcurrentMap&);
+  ConcurrentMap& operator=(const ConcurrentMap&);
+
+  struct Entry : public Collectable {
+
+    Entry(const K& k, const RootPtr<V>& v, const RootPtr<Entry>& n)
+    : key(k), value(this, v), next(this, n) { }
+
+    const K key;
+    EdgePtr<V> value;
+    EdgePtr<Entry> next;
+  };
+
+  struct Table : public Collectable {
+
+    explicit Table(size_t n) : mask(n - 1) {
+      for(size_t i = 0; i < n; ++i) {
+        buckets.emplace_back(this);
+      }
+    }
+
+    AtomicEdgePtr<Entry>& Bucket(size_t hash) {
+      return buckets[hash & mask];
+    }
+
+    std::deque< AtomicEdgePtr<Entry> > buckets;
+    size_t mask;
+  };
+
+  struct Head : public Collectable {
+    Head() : table(this) { }
+    AtomicEdgePtr<Table> table;
+  };
+
+  // Find key in a bucket, collecting the entries before it.
+  // Only call with the write lock held.
+  static Entry* _Find(AtomicEdgePtr<Entry>& bucket, const K& key, std::vector<Entry*>& prefix) {
+    for(Entry* entry = bucket.Get(); entry; entry = entry->next.Get()) {
+      if(entry->key == key) {
+        return entry;
+      }
+      prefix.push_back(entry);
+    }
+    return 0;
+  }
+
+  // Copy the prefix of a chain in front of rest.
+  static RootPtr<Entry> _Copy(const std::vector<Entry*>& prefix, RootPtr<Entry> rest) {
+    for(size_t i = prefix.size(); i-- > 0; ) {
+      rest = RootPtr<Entry>(new Entry(prefix[i]->key, prefix[i]->value.GetRootPtr(), rest));
+    }
+    return rest;
+  }
+
+  // Double the number of buckets. Entries can't be relinked,
+  // so the new table gets new ones.
+  void _Grow() {
+
+    Table* old = _head->table.Get();
+    RootPtr<Table> table(new Table(old->buckets.size() * 2));
+
+    for(auto& bucket : old->buckets) {
+      for(Entry* entry = bucket.Get(); entry; entry = entry->next.Get()) {
+        AtomicEdgePtr<Entry>& target = table->Bucket(_hash(entry->key));
+        RootPtr<Entry> rest(target.Get());
+        target.store(RootPtr<Entry>(new Entry(entry->key, entry->value.GetRootPtr(), rest)));
+      }
+    }
+
+    _head->table.store(table);
+  }
+
+  RootPtr<Head> _head;
+  Hash _hash;
+  std::atomic<size_t> _size;
+
+  boost::mutex _writeMutex;
+
+}; // class ConcurrentMap
+
+#endif /* defined(__Dev__ConcurrentMap__) */
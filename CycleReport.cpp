@@ -0,0 +1,184 @@
+//
+//  CycleReport.cpp
+//
+//  Finds the strongly connected components of the
+//  garbage, to see which cycles dominate it.
+//
+
+#include "Collector.hpp"
+#include <algorithm>
+#include <unordered_map>
+#include <boost/core/demangle.hpp>
+
+void Collector::SetCycleReporting(bool enabled, size_t maxPatterns) {
+
+  boost::mutex::scoped_lock lock(_mutex);
+
+  _reportCycles = enabled;
+  _maxCyclePatterns = maxPatterns;
+
+}
+
+CycleReport Collector::GetCycleReport() {
+
+  boost::mutex::scoped_lock lock(_mutex);
+
+  return _cycleReport;
+}
+
+void Collector::_ReportCycles(const std::vector<NodeId>& garbage) {
+
+  // Local indices of the garbage nodes.
+  std::unordered_map<NodeId, size_t> indices;
+  indices.reserve(garbage.size());
+
+  for(size_t i = 0; i < garbage.size(); ++i) {
+    indices[garbage[i]] = i;
+  }
+
+  // Tarjan's algorithm, iteratively, over the
+  // connections between garbage nodes.
+  const size_t Unvisited = ~size_t(0);
+
+  std::vector<size_t> order(garbage.size(), Unvisited);
+  std::vector<size_t> low(garbage.size());
+  std::vector<bool> onStack(garbage.size(), false);
+  std::vector<size_t> stack;
+
+  // Node and position in its connections.
+  std::vector< std::pair<size_t, size_t> > callStack;
+
+  std::map<std::string, CycleReport::Pattern> patterns;
+  size_t counter = 0;
+  size_t cyclicNodes = 0;
+
+  for(size_t root = 0; root < garbage.size(); ++root) {
+
+    if(order[root] != Unvisited) {
+      continue;
+    }
+
+    callStack.push_back(std::make_pair(root, size_t(0)));
+    order[root] = low[root] = counter++;
+    stack.push_back(root);
+    onStack[root] = true;
+
+    while(! callStack.empty()) {
+
+      size_t v = callStack.back().first;
+      size_t& edge = callStack.back().second;
+      const std::vector<NodeId>& adj = _info[garbage[v]].connections;
+
+      if(edge < adj.size()) {
+
+        auto iter = indices.find(adj[edge++]);
+
+        // Live node.
+        if(iter == indices.end()) {
+          continue;
+        }
+
+        size_t w = iter->second;
+
+        if(order[w] == Unvisited) {
+          order[w] = low[w] = counter++;
+          stack.push_back(w);
+          onStack[w] = true;
+          callStack.push_back(std::make_pair(w, size_t(0)));
+        } else if(onStack[w]) {
+          low[v] = std::min(low[v], order[w]);
+        }
+
+        continue;
+      }
+
+      callStack.pop_back();
+
+      if(! callStack.empty()) {
+        size_t parent = callStack.back().first;
+        low[parent] = std::min(low[parent], low[v]);
+      }
+
+      if(low[v] != order[v]) {
+        continue;
+      }
+
+      // v is the root of a component.
+      std::vector<size_t> component;
+      size_t w;
+      do {
+        w = stack.back();
+        stack.pop_back();
+        onStack[w] = false;
+        component.push_back(w);
+      } while(w != v);
+
+      // A single node is only a cycle if
+      // it points to itself.
+      if(component.size() == 1) {
+        const std::vector<NodeId>& vadj = _info[garbage[v]].connections;
+        if(std::find(vadj.begin(), vadj.end(), garbage[v]) == vadj.end()) {
+          continue;
+        }
+      }
+
+      std::vector<std::string> names;
+      size_t bytes = 0;
+
+      for(auto i : component) {
+
+        Collectable* node = _nodes[garbage[i]];
+        auto type = _typeIndices.find(typeid(*node));
+
+        if(type != _typeIndices.end()) {
+          names.push_back(_types[type->second].name);
+          bytes += _types[type->second].size;
+        } else {
+          names.push_back(boost::core::demangle(typeid(*node).name()));
+          bytes += sizeof(Collectable);
+        }
+      }
+
+      std::sort(names.begin(), names.end());
+      names.erase(std::unique(names.begin(), names.end()), names.end());
+
+      std::string types;
+      for(size_t i = 0; i < names.size(); ++i) {
+        if(i) {
+          types += " <-> ";
+        }
+        types += names[i];
+      }
+
+      CycleReport::Pattern& pattern = patterns[types];
+      if(pattern.types.empty()) {
+        pattern.types = types;
+        pattern.cycles = pattern.nodes = pattern.bytes = 0;
+      }
+
+      pattern.cycles++;
+      pattern.nodes += component.size();
+      pattern.bytes += bytes;
+      cyclicNodes += component.size();
+    }
+  }
+
+  CycleReport report;
+  report.freedNodes = garbage.size();
+  report.cyclicNodes = cyclicNodes;
+
+  for(auto& entry : patterns) {
+    report.patterns.push_back(entry.second);
+  }
+
+  std::sort(report.patterns.begin(), report.patterns.end(),
+            [](const CycleReport::Pattern& a, const CycleReport::Pattern& b) {
+              return a.bytes > b.bytes;
+            });
+
+  if(report.patterns.size() > _maxCyclePatterns) {
+    report.patterns.resize(_maxCyclePatterns);
+  }
+
+  _cycleReport = report;
+}
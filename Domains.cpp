@@ -0,0 +1,114 @@
+//
+//  Domains.cpp
+//
+//  Attributes live nodes to the domains whose
+//  roots reach them.
+//
+
+#include "Collector.hpp"
+#include <algorithm>
+
+const unsigned Collector::NoDomain;
+const unsigned Collector::SharedDomain;
+
+void Collector::SetDomainAttribution(bool enabled) {
+
+  boost::mutex::scoped_lock lock(_mutex);
+
+  _attributeDomains = enabled;
+
+  if(! enabled) {
+    _domainUsage.clear();
+  }
+
+}
+
+std::map<unsigned, DomainUsage> Collector::GetDomainUsage() {
+
+  boost::mutex::scoped_lock lock(_mutex);
+
+  return _domainUsage;
+}
+
+void Collector::_MarkDomains(std::vector<NodeId>& nodeStack) {
+
+  // Tagged roots by domain. Untagged ones go
+  // straight on the stack, and are marked last.
+  std::map<unsigned, std::vector<NodeId> > roots;
+
+  for(NodeId id = NodeId(_nodes.size()); id-- > 0; ) {
+
+    const NodeInfo& info = _info[id];
+
+    if(info.rootCount) {
+      if(info.rootDomain == NoDomain) {
+        nodeStack.push_back(id);
+      } else {
+        roots[info.rootDomain].push_back(id);
+      }
+    }
+  }
+
+  // See _Mark for why tracing containers here is safe.
+  {
+    boost::mutex::scoped_lock lock(_containerMutex);
+
+    for(auto container : _containers) {
+      unsigned domain = container->GCDomain();
+      _TraceContainer(container, domain == NoDomain ? nodeStack : roots[domain]);
+    }
+  }
+
+  for(auto& group : roots) {
+    _MarkFrom(group.second, group.first);
+  }
+
+  _MarkFrom(nodeStack, NoDomain);
+
+}
+
+void Collector::_MarkFrom(std::vector<NodeId>& nodeStack, unsigned domain) {
+
+  while(! nodeStack.empty()) {
+
+    _maxMarkStack = std::max(_maxMarkStack, nodeStack.size());
+
+    NodeId id = nodeStack.back();
+    nodeStack.pop_back();
+
+    NodeInfo& info = _info[id];
+
+    if(info.sequence != _sequence) {
+      info.sequence = _sequence;
+      info.domain = domain;
+      _markedEdges += info.connections.size();
+
+      if(_recordMarkOrder) {
+        _markOrder.push_back(id);
+      }
+    } else if(domain != NoDomain && info.domain != domain &&
+              info.domain != SharedDomain) {
+
+      // Marked by an earlier domain, so everything
+      // below it was too. Revisit it once to pass
+      // on the sharing.
+      info.domain = SharedDomain;
+    } else {
+      continue;
+    }
+
+    nodeStack.insert(nodeStack.end(), info.connections.begin(), info.connections.end());
+  }
+
+}
+
+size_t Collector::_SizeOf(Collectable* node) {
+
+  auto type = _typeIndices.find(typeid(*node));
+
+  if(type != _typeIndices.end()) {
+    return _types[type->second].size;
+  }
+
+  return sizeof(Collectable);
+}
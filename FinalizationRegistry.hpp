@@ -0,0 +1,98 @@
+//
+//  FinalizationRegistry.h
+//
+//  Cleanup of resources owned by collected objects,
+//  on a thread of your choosing.
+//
+
+#ifndef __Dev__FinalizationRegistry__
+#define __Dev__FinalizationRegistry__
+
+#include "Collector.hpp"
+#include <map>
+
+// Delivers cleanup tokens for collected objects to
+// whichever thread calls Drain, rather than releasing
+// resources in destructors on the collector thread.
+//
+// When Collect frees a registered object, its tokens go
+// on a lock-free queue. Token must be trivially copyable,
+// such as a handle or an index.
+template<typename Token>
+class FinalizationRegistry : public FinalizationRegistryBase {
+
+public:
+
+  FinalizationRegistry() : _queue(1024) {
+    Collector::GetInstance().AddFinalizationRegistry(this);
+  }
+
+  ~FinalizationRegistry() {
+    Collector::GetInstance().RemoveFinalizationRegistry(this);
+  }
+
+  // Queue token when p is collected. An object can
+  // be registered more than once.
+  template<class T>
+  void Register(const RootPtr<T>& p, const Token& token) {
+    assert(p);
+    boost::mutex::scoped_lock lock(_mutex);
+    _tokens.insert(std::make_pair(static_cast<Collectable*>(p.Get()), token));
+  }
+
+  // Forget the tokens for p, say if its resource
+  // was released early.
+  void Unregister(Collectable* p) {
+    boost::mutex::scoped_lock lock(_mutex);
+    _tokens.erase(p);
+  }
+
+  // Call f with each token queued since the last call,
+  // on the calling thread. Returns how many there were.
+  template<class F>
+  size_t Drain(F f) {
+    size_t n = 0;
+    Token token;
+    while(_queue.pop(token)) {
+      f(token);
+      ++n;
+    }
+    return n;
+  }
+
+  void GCFreeing(const std::vector<Collectable*>& garbage) {
+
+    boost::mutex::scoped_lock lock(_mutex);
+
+    // Both are sorted by address, so merge them.
+    auto node = garbage.begin();
+    auto iter = _tokens.begin();
+
+    while(node != garbage.end() && iter != _tokens.end()) {
+
+      if(*node < iter->first) {
+        ++node;
+      } else if(iter->first < *node) {
+        ++iter;
+      } else {
+        _queue.push(iter->second);
+        iter = _tokens.erase(iter);
+      }
+    }
+  }
+
+private:
+
+  FinalizationRegistry(const FinalizationRegistry&);
+  FinalizationRegistry& operator=(const FinalizationRegistry&);
+
+  std::multimap<Collectable*, Token> _tokens;
+  boost::mutex _mutex;
+
+  // Not fixed size, so the collector never blocks
+  // on a thread which is slow to drain.
+  boost::lockfree::queue<Token> _queue;
+
+}; // class FinalizationRegistry
+
+#endif /* defined(__Dev__FinalizationRegistry__) */
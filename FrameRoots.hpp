@@ -0,0 +1,127 @@
+//
+//  FrameRoots.h
+//
+//  Rooting for the collected locals of a coroutine
+//  frame, as a single root container.
+//
+
+#ifndef __Dev__FrameRoots__
+#define __Dev__FrameRoots__
+
+#include "Collector.hpp"
+#include <algorithm>
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#endif
+
+// Holds the collected locals of a long-lived frame, such
+// as a coroutine's, across suspension points. The frame
+// registers with the collector once, and holding or
+// releasing a local doesn't generate events, unlike
+// keeping RootPtrs alive across each co_await.
+//
+// A frame only runs on one thread at a time, so the
+// lock is only against the collector.
+class FrameRoots : public RootContainer {
+
+public:
+
+  FrameRoots() {
+    Collector::GetInstance().AddRootContainer(this);
+  }
+
+  ~FrameRoots() {
+    Collector::GetInstance().RemoveRootContainer(this);
+  }
+
+  // Keep p alive until it's released or the frame
+  // is destroyed. Returns the raw pointer for use
+  // in the frame.
+  template<class T>
+  T* Hold(const RootPtr<T>& p) {
+    boost::mutex::scoped_lock lock(_mutex);
+    _locals.push_back(p.Get());
+    return p.Get();
+  }
+
+  // Stop holding one reference to p.
+  void Release(Collectable* p) {
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      auto iter = std::find(_locals.begin(), _locals.end(), p);
+      assert(iter != _locals.end());
+      if(iter != _locals.end()) {
+        *iter = _locals.back();
+        _locals.pop_back();
+      }
+    }
+    Collector::GetInstance().RootContainerChanged();
+  }
+
+  void Clear() {
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      _locals.clear();
+    }
+    Collector::GetInstance().RootContainerChanged();
+  }
+
+  size_t Size() const { return _locals.size(); }
+
+  void GCTrace(std::vector<Collectable*>& nodes) {
+    boost::mutex::scoped_lock lock(_mutex);
+    for(auto p : _locals) {
+      if(p) {
+        nodes.push_back(p);
+      }
+    }
+  }
+
+private:
+
+  FrameRoots(const FrameRoots&);
+  FrameRoots& operator=(const FrameRoots&);
+
+  std::vector<Collectable*> _locals;
+  boost::mutex _mutex;
+
+}; // class FrameRoots
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+// Derive a coroutine's promise type from this to give
+// each frame its own FrameRoots. They're unregistered
+// when the frame is destroyed.
+struct FrameRootsPromise {
+  FrameRoots gcRoots;
+};
+
+// Awaiting this inside a coroutine whose promise derives
+// from FrameRootsPromise gets the frame's roots without
+// suspending:
+//
+//   FrameRoots& roots = co_await GetFrameRoots();
+//   Node* node = roots.Hold(rootPtr);
+//
+struct GetFrameRoots {
+
+  bool await_ready() const noexcept { return false; }
+
+  template<class Promise>
+  bool await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+    _roots = &static_cast<FrameRootsPromise&>(handle.promise()).gcRoots;
+    return false;
+  }
+
+  FrameRoots& await_resume() const noexcept { return *_roots; }
+
+private:
+
+  FrameRoots* _roots = nullptr;
+
+};
+
+#endif
+
+#endif /* defined(__Dev__FrameRoots__) */
@@ -0,0 +1,96 @@
+//
+//  GcFunction.h
+//
+//  Collected closures.
+//
+
+#ifndef __Dev__GcFunction__
+#define __Dev__GcFunction__
+
+#include "Collector.hpp"
+#include <tuple>
+#include <utility>
+
+template<typename Sig>
+class GcFunction;
+
+// A collected closure. Unlike a std::function capturing
+// RootPtrs, the Collectables it captures are edges of the
+// closure, so callbacks stored in collected objects don't
+// keep everything they capture alive forever. Create with
+// MakeGcFunction.
+template<typename R, typename... Args>
+class GcFunction<R(Args...)> : public Collectable {
+
+public:
+
+  virtual R operator()(Args... args) = 0;
+
+};
+
+template<size_t... Is>
+struct GcIndices { };
+
+template<size_t N, size_t... Is>
+struct GcMakeIndices : GcMakeIndices<N - 1, N - 1, Is...> { };
+
+template<size_t... Is>
+struct GcMakeIndices<0, Is...> {
+  typedef GcIndices<Is...> Type;
+};
+
+template<typename Sig, typename F, typename... Captures>
+class GcClosure;
+
+// The implementation of a GcFunction. Calls f with raw
+// pointers to the captures followed by the arguments.
+template<typename R, typename... Args, typename F, typename... Captures>
+class GcClosure<R(Args...), F, Captures...> : public GcFunction<R(Args...)> {
+
+public:
+
+  GcClosure(F f, const RootPtr<Captures>&... captures)
+  : _f(std::move(f)), _captures(_Owner<Captures>(this)...) {
+    _Capture(typename GcMakeIndices<sizeof...(Captures)>::Type(), captures...);
+  }
+
+  R operator()(Args... args) {
+    return _Call(typename GcMakeIndices<sizeof...(Captures)>::Type(),
+                 std::forward<Args>(args)...);
+  }
+
+private:
+
+  template<class T>
+  static Collectable* _Owner(Collectable* owner) { return owner; }
+
+  template<size_t... Is>
+  void _Capture(GcIndices<Is...>, const RootPtr<Captures>&... captures) {
+    int expand[] = { 0, ((void) (std::get<Is>(_captures) = captures), 0)... };
+    (void) expand;
+  }
+
+  template<size_t... Is>
+  R _Call(GcIndices<Is...>, Args... args) {
+    return _f(std::get<Is>(_captures).Get()..., std::forward<Args>(args)...);
+  }
+
+  F _f;
+  std::tuple< EdgePtr<Captures>... > _captures;
+
+}; // class GcClosure
+
+// Make a GcFunction with signature Sig which calls f
+// with pointers to the captured Collectables, then
+// its arguments:
+//
+//   auto onClick = MakeGcFunction<void(int)>(
+//     [](Node* node, int button) { node->Click(button); },
+//     node);
+//
+template<typename Sig, typename F, typename... Captures>
+RootPtr< GcFunction<Sig> > MakeGcFunction(F f, const RootPtr<Captures>&... captures) {
+  return RootPtr< GcFunction<Sig> >(new GcClosure<Sig, F, Captures...>(std::move(f), captures...));
+}
+
+#endif /* defined(__Dev__GcFunction__) */
@@ -0,0 +1,91 @@
+//
+//  GraphShape.cpp
+//
+//  Samples the shape of the live graph, to tell which
+//  representation and marking strategy would suit it.
+//
+
+#include "Collector.hpp"
+#include <algorithm>
+#include <cmath>
+
+const double ShapeSample::Bounds[Buckets] = {
+  0, 1, 3, 7, 15, 31, 63, 127, 255, 511, 1023, 2047, 4095, 8191, 16383, HUGE_VAL
+};
+
+ShapeSample::ShapeSample()
+: collection(0), nodes(0), edges(0), maxDegree(0), maxMarkStack(0), roots(0) {
+
+  std::fill(degreeCounts, degreeCounts + Buckets, 0);
+  std::fill(rootCounts, rootCounts + Buckets, 0);
+  std::fill(events, events + 4, 0);
+}
+
+size_t ShapeSample::Bucket(size_t n) {
+
+  size_t bucket = 0;
+  while(n) {
+    n >>= 1;
+    ++bucket;
+  }
+
+  return std::min(bucket, size_t(Buckets - 1));
+}
+
+void Collector::SetShapeProfiling(size_t interval, size_t history) {
+
+  boost::mutex::scoped_lock lock(_mutex);
+
+  _shapeInterval = interval;
+  _shapeHistory = history;
+  _marksSinceSample = 0;
+
+  while(_shapeSamples.size() > _shapeHistory) {
+    _shapeSamples.pop_front();
+  }
+
+}
+
+std::vector<ShapeSample> Collector::GetShapeSamples() {
+
+  boost::mutex::scoped_lock lock(_mutex);
+
+  return std::vector<ShapeSample>(_shapeSamples.begin(), _shapeSamples.end());
+}
+
+void Collector::_SampleShape() {
+
+  ShapeSample sample;
+  sample.collection = _stats.collections + 1;
+  sample.nodes = _liveNodes;
+  sample.maxMarkStack = _maxMarkStack;
+
+  for(auto& info : _info) {
+
+    if(! info.tracked) {
+      continue;
+    }
+
+    size_t degree = info.connections.size();
+    sample.edges += degree;
+    sample.degreeCounts[ShapeSample::Bucket(degree)]++;
+    sample.maxDegree = std::max(sample.maxDegree, degree);
+
+    if(info.rootCount) {
+      sample.rootCounts[ShapeSample::Bucket(info.rootCount)]++;
+      sample.roots += info.rootCount;
+    }
+  }
+
+  for(size_t i = 0; i < 4; ++i) {
+    sample.events[i] = _stats.events[i] - _sampledEvents[i];
+    _sampledEvents[i] = _stats.events[i];
+  }
+
+  _shapeSamples.push_back(sample);
+
+  while(_shapeSamples.size() > _shapeHistory) {
+    _shapeSamples.pop_front();
+  }
+
+}
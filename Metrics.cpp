@@ -0,0 +1,174 @@
+//
+//  Metrics.cpp
+//
+//  Exports the collector's stats in Prometheus
+//  text format.
+//
+
+#include "Collector.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+const double CollectorStats::PauseBounds[PauseBuckets] = {
+  0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, HUGE_VAL
+};
+
+const double CollectorStats::FreedBounds[FreedBuckets] = {
+  0, 10, 100, 1000, 10000, 100000, 1000000, HUGE_VAL
+};
+
+CollectorStats::CollectorStats()
+: collections(0), pauseSeconds(0), maxQueueDepth(0),
+  liveNodes(0), liveEdges(0), freedNodes(0), skippedMarks(0) {
+
+  std::fill(pauseCounts, pauseCounts + PauseBuckets, 0);
+  std::fill(events, events + 4, 0);
+  std::fill(freedCounts, freedCounts + FreedBuckets, 0);
+}
+
+void Collector::SetMetricsFile(const std::string& path, double interval) {
+
+  boost::mutex::scoped_lock lock(_mutex);
+
+  _metricsPath = path;
+  _metricsInterval = interval;
+  _lastMetricsWrite = std::chrono::steady_clock::time_point();
+
+}
+
+CollectorStats Collector::GetStats() {
+
+  boost::mutex::scoped_lock lock(_mutex);
+
+  return _stats;
+}
+
+namespace {
+
+  void WriteBound(std::ostream& out, double bound) {
+    if(bound == HUGE_VAL) {
+      out << "+Inf";
+    } else {
+      out << bound;
+    }
+  }
+
+  void WriteHistogram(std::ostream& out, const char* name, const char* help,
+                      const double* bounds, const size_t* counts, size_t buckets,
+                      double sum) {
+
+    out << "# TYPE " << name << " histogram\n";
+    out << "# HELP " << name << " " << help << "\n";
+
+    size_t total = 0;
+
+    for(size_t i = 0; i < buckets; ++i) {
+      total += counts[i];
+      out << name << "_bucket{le=\"";
+      WriteBound(out, bounds[i]);
+      out << "\"} " << total << "\n";
+    }
+
+    out << name << "_sum " << sum << "\n";
+    out << name << "_count " << total << "\n";
+  }
+
+  // Shape distributions are snapshots which can go down,
+  // so they're gauges rather than a histogram's counters,
+  // still cumulative by le.
+  void WriteGaugeBuckets(std::ostream& out, const char* name, const char* help,
+                         const double* bounds, const size_t* counts, size_t buckets) {
+
+    out << "# TYPE " << name << " gauge\n";
+    out << "# HELP " << name << " " << help << "\n";
+
+    size_t total = 0;
+
+    for(size_t i = 0; i < buckets; ++i) {
+      total += counts[i];
+      out << name << "{le=\"";
+      WriteBound(out, bounds[i]);
+      out << "\"} " << total << "\n";
+    }
+  }
+
+}
+
+void Collector::_WriteMetrics() {
+
+  const CollectorStats& s = _stats;
+
+  std::string tmpPath = _metricsPath + ".tmp";
+  std::ofstream out(tmpPath.c_str(), std::ios::trunc);
+
+  out << "# TYPE collector_collections_total counter\n";
+  out << "# HELP collector_collections_total Calls to Collect.\n";
+  out << "collector_collections_total " << s.collections << "\n";
+
+  WriteHistogram(out, "collector_pause_seconds", "Time spent in Collect.",
+                 CollectorStats::PauseBounds, s.pauseCounts, CollectorStats::PauseBuckets,
+                 s.pauseSeconds);
+
+  static const char* eventNames[4] = { "add_root", "remove_root", "connect", "disconnect" };
+
+  out << "# TYPE collector_events_total counter\n";
+  out << "# HELP collector_events_total Events processed from mutator threads.\n";
+  for(size_t i = 0; i < 4; ++i) {
+    out << "collector_events_total{type=\"" << eventNames[i] << "\"} " << s.events[i] << "\n";
+  }
+
+  out << "# TYPE collector_queue_depth_max gauge\n";
+  out << "# HELP collector_queue_depth_max Most events waiting in the queue when the collector drained it.\n";
+  out << "collector_queue_depth_max " << s.maxQueueDepth << "\n";
+
+  out << "# TYPE collector_live_nodes gauge\n";
+  out << "# HELP collector_live_nodes Nodes alive after the last collection.\n";
+  out << "collector_live_nodes " << s.liveNodes << "\n";
+
+  out << "# TYPE collector_live_edges gauge\n";
+  out << "# HELP collector_live_edges Edges from live nodes at the last collection.\n";
+  out << "collector_live_edges " << s.liveEdges << "\n";
+
+  out << "# TYPE collector_freed_nodes_total counter\n";
+  out << "# HELP collector_freed_nodes_total Nodes freed.\n";
+  out << "collector_freed_nodes_total " << s.freedNodes << "\n";
+
+  WriteHistogram(out, "collector_freed_per_cycle", "Nodes freed by each collection.",
+                 CollectorStats::FreedBounds, s.freedCounts, CollectorStats::FreedBuckets,
+                 double(s.freedNodes));
+
+  out << "# TYPE collector_skipped_marks_total counter\n";
+  out << "# HELP collector_skipped_marks_total Collections whose targeted checks made marking unnecessary.\n";
+  out << "collector_skipped_marks_total " << s.skippedMarks << "\n";
+
+  if(! _shapeSamples.empty()) {
+
+    const ShapeSample& shape = _shapeSamples.back();
+
+    WriteGaugeBuckets(out, "collector_out_degree_nodes",
+                      "Live nodes with at most le connections, at the last shape sample.",
+                      ShapeSample::Bounds, shape.degreeCounts, ShapeSample::Buckets);
+
+    WriteGaugeBuckets(out, "collector_root_count_nodes",
+                      "Rooted nodes with at most le roots, at the last shape sample.",
+                      ShapeSample::Bounds, shape.rootCounts, ShapeSample::Buckets);
+
+    out << "# TYPE collector_mark_stack_max gauge\n";
+    out << "# HELP collector_mark_stack_max Deepest mark stack, at the last shape sample.\n";
+    out << "collector_mark_stack_max " << shape.maxMarkStack << "\n";
+  }
+
+  out.close();
+
+  if(!out) {
+    std::cout << "Warning: failed to write metrics to " << tmpPath << std::endl;
+    return;
+  }
+
+  if(std::rename(tmpPath.c_str(), _metricsPath.c_str()) != 0) {
+    std::cout << "Warning: failed to rename metrics to " << _metricsPath << std::endl;
+  }
+}
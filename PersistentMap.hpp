@@ -0,0 +1,446 @@
+//
+//  PersistentMap.h
+//
+//  An immutable hash map to Collectables whose
+//  versions share structure.
+//
+
+#ifndef __Dev__PersistentMap__
+#define __Dev__PersistentMap__
+
+#include "Collector.hpp"
+#include <bitset>
+#include <cstdint>
+#include <functional>
+
+// A map where every update returns a new version and
+// leaves the old one as it was. It's a hash array mapped
+// trie: each Collectable node uses 5 bits of the key's
+// hash to pick a slot, and keeps bitmaps of which slots
+// hold entries and which hold child nodes, so it only
+// stores the slots in use. An update copies the path to
+// the key, O(log32 n) nodes, and shares the rest.
+//
+// Erasing moves a lone entry back up into its parent, so
+// the same keys always give the same shape. Keys whose
+// hashes are equal end up in a list at the bottom.
+template<typename K, typename V, typename Hash = std::hash<K> >
+class PersistentMap {
+
+public:
+
+  PersistentMap() : _root(new Node(0, 0)), _size(0) { }
+
+  size_t Size() const { return _size; }
+  bool Empty() const { return _size == 0; }
+
+  // Returns null if key isn't there. Valid while this
+  // version is.
+  V* Find(const K& key) const {
+
+    const Node* node = _root.Get();
+    size_t hash = _hash(key);
+
+    for(size_t shift = 0; shift < HashBits; shift += Bits) {
+
+      uint32_t bit = _Bit(hash, shift);
+
+      if(node->datamap & bit) {
+        size_t index = _Index(node->datamap, bit);
+        return node->keys[index] == key ? node->values[index].Get() : 0;
+      }
+
+      if(!(node->nodemap & bit)) {
+        return 0;
+      }
+
+      node = node->children[_Index(node->nodemap, bit)].Get();
+    }
+
+    for(size_t i = 0; i < node->keys.size(); ++i) {
+      if(node->keys[i] == key) {
+        return node->values[i].Get();
+      }
+    }
+
+    return 0;
+  }
+
+  // Insert or replace.
+  PersistentMap Set(const K& key, const RootPtr<V>& value) const {
+
+    bool added = false;
+
+    PersistentMap result(*this);
+    result._root = _Set(_root.Get(), 0, _hash(key), key, value, added);
+
+    if(added) {
+      ++result._size;
+    }
+
+    return result;
+  }
+
+  PersistentMap Erase(const K& key) const {
+
+    bool removed = false;
+    RootPtr<Node> root = _Erase(_root.Get(), 0, _hash(key), key, removed);
+
+    if(!removed) {
+      return *this;
+    }
+
+    PersistentMap result(*this);
+    result._root = root;
+    --result._size;
+
+    return result;
+  }
+
+  // Call f(key, value) for each entry, in no
+  // particular order.
+  template<typename F>
+  void ForEach(F f) const {
+    _ForEach(_root.Get(), f);
+  }
+
+private:
+
+  enum { Bits = 5, Mask = (1 << Bits) - 1, HashBits = sizeof(size_t) * 8 };
+
+  struct Node : public Collectable {
+
+    // Room for everything the maps say it holds, plus
+    // listed entries below the last level, since growing
+    // the vectors would copy each EdgePtr, queueing events.
+    Node(uint32_t d, uint32_t n, size_t listed = 0) : datamap(d), nodemap(n) {
+      keys.reserve(std::bitset<32>(d).count() + listed);
+      values.reserve(std::bitset<32>(d).count() + listed);
+      children.reserve(std::bitset<32>(n).count());
+    }
+
+    void AddData(const K& key, const RootPtr<V>& value) {
+      keys.push_back(key);
+      values.emplace_back(this, value);
+    }
+
+    void CopyData(const Node* from, size_t i) {
+      keys.push_back(from->keys[i]);
+      values.emplace_back(this, from->values[i]);
+    }
+
+    void CopyChild(const Node* from, size_t i) {
+      children.emplace_back(this, from->children[i]);
+    }
+
+    void CopyChildren(const Node* from) {
+      for(size_t i = 0; i < from->children.size(); ++i) {
+        CopyChild(from, i);
+      }
+    }
+
+    // Which of the 32 slots hold entries, and which
+    // hold children. Both are zero below the last level,
+    // where keys with colliding hashes are listed.
+    uint32_t datamap;
+    uint32_t nodemap;
+
+    std::vector<K> keys;
+    std::vector< EdgePtr<V> > values;
+    std::vector< EdgePtr<Node> > children;
+  };
+
+  static uint32_t _Bit(size_t hash, size_t shift) {
+    return uint32_t(1) << ((hash >> shift) & Mask);
+  }
+
+  // Position of bit's slot among those in use.
+  static size_t _Index(uint32_t map, uint32_t bit) {
+    return std::bitset<32>(map & (bit - 1)).count();
+  }
+
+  RootPtr<Node> _Set(const Node* node, size_t shift, size_t hash,
+                     const K& key, const RootPtr<V>& value, bool& added) const {
+
+    if(shift >= HashBits) {
+
+      bool found = _Contains(node, key);
+      RootPtr<Node> copy(new Node(0, 0, node->keys.size() + (found ? 0 : 1)));
+
+      for(size_t i = 0; i < node->keys.size(); ++i) {
+        if(node->keys[i] == key) {
+          copy->AddData(key, value);
+        } else {
+          copy->CopyData(node, i);
+        }
+      }
+
+      if(!found) {
+        copy->AddData(key, value);
+        added = true;
+      }
+
+      return copy;
+    }
+
+    uint32_t bit = _Bit(hash, shift);
+
+    if(node->datamap & bit) {
+
+      size_t index = _Index(node->datamap, bit);
+
+      // Replace the value.
+      if(node->keys[index] == key) {
+
+        RootPtr<Node> copy(new Node(node->datamap, node->nodemap));
+
+        for(size_t i = 0; i < node->keys.size(); ++i) {
+          if(i == index) {
+            copy->AddData(key, value);
+          } else {
+            copy->CopyData(node, i);
+          }
+        }
+
+        copy->CopyChildren(node);
+
+        return copy;
+      }
+
+      // Another key shares the slot, so push them
+      // both down into a new child.
+      RootPtr<Node> child = _Merge(node, index, _hash(node->keys[index]), key, value, hash, shift + Bits);
+      added = true;
+
+      RootPtr<Node> copy(new Node(node->datamap ^ bit, node->nodemap | bit));
+
+      for(size_t i = 0; i < node->keys.size(); ++i) {
+        if(i != index) {
+          copy->CopyData(node, i);
+        }
+      }
+
+      size_t at = _Index(node->nodemap, bit);
+
+      for(size_t i = 0; i < node->children.size(); ++i) {
+        if(i == at) {
+          copy->children.emplace_back(copy.Get(), child);
+        }
+        copy->CopyChild(node, i);
+      }
+
+      if(at == node->children.size()) {
+        copy->children.emplace_back(copy.Get(), child);
+      }
+
+      return copy;
+    }
+
+    if(node->nodemap & bit) {
+
+      size_t index = _Index(node->nodemap, bit);
+      RootPtr<Node> child = _Set(node->children[index].Get(), shift + Bits, hash, key, value, added);
+
+      RootPtr<Node> copy(new Node(node->datamap, node->nodemap));
+
+      for(size_t i = 0; i < node->keys.size(); ++i) {
+        copy->CopyData(node, i);
+      }
+
+      for(size_t i = 0; i < node->children.size(); ++i) {
+        if(i == index) {
+          copy->children.emplace_back(copy.Get(), child);
+        } else {
+          copy->CopyChild(node, i);
+        }
+      }
+
+      return copy;
+    }
+
+    // Empty slot.
+    added = true;
+
+    size_t index = _Index(node->datamap, bit);
+    RootPtr<Node> copy(new Node(node->datamap | bit, node->nodemap));
+
+    for(size_t i = 0; i < node->keys.size(); ++i) {
+      if(i == index) {
+        copy->AddData(key, value);
+      }
+      copy->CopyData(node, i);
+    }
+
+    if(index == node->keys.size()) {
+      copy->AddData(key, value);
+    }
+
+    copy->CopyChildren(node);
+
+    return copy;
+  }
+
+  // A node holding from's entry i and key, starting at shift.
+  static RootPtr<Node> _Merge(const Node* from, size_t i, size_t fromHash,
+                              const K& key, const RootPtr<V>& value, size_t hash, size_t shift) {
+
+    if(shift >= HashBits) {
+      RootPtr<Node> node(new Node(0, 0, 2));
+      node->CopyData(from, i);
+      node->AddData(key, value);
+      return node;
+    }
+
+    uint32_t fromBit = _Bit(fromHash, shift);
+    uint32_t bit = _Bit(hash, shift);
+
+    if(fromBit == bit) {
+      RootPtr<Node> node(new Node(0, bit));
+      node->children.emplace_back(node.Get(), _Merge(from, i, fromHash, key, value, hash, shift + Bits));
+      return node;
+    }
+
+    RootPtr<Node> node(new Node(fromBit | bit, 0));
+
+    if(fromBit < bit) {
+      node->CopyData(from, i);
+      node->AddData(key, value);
+    } else {
+      node->AddData(key, value);
+      node->CopyData(from, i);
+    }
+
+    return node;
+  }
+
+  // Returns null and leaves removed false if key
+  // isn't there.
+  RootPtr<Node> _Erase(const Node* node, size_t shift, size_t hash,
+                       const K& key, bool& removed) const {
+
+    if(shift >= HashBits) {
+
+      if(!_Contains(node, key)) {
+        return RootPtr<Node>();
+      }
+
+      removed = true;
+
+      RootPtr<Node> copy(new Node(0, 0, node->keys.size() - 1));
+
+      for(size_t i = 0; i < node->keys.size(); ++i) {
+        if(!(node->keys[i] == key)) {
+          copy->CopyData(node, i);
+        }
+      }
+
+      return copy;
+    }
+
+    uint32_t bit = _Bit(hash, shift);
+
+    if(node->datamap & bit) {
+
+      size_t index = _Index(node->datamap, bit);
+
+      if(!(node->keys[index] == key)) {
+        return RootPtr<Node>();
+      }
+
+      removed = true;
+
+      RootPtr<Node> copy(new Node(node->datamap ^ bit, node->nodemap));
+
+      for(size_t i = 0; i < node->keys.size(); ++i) {
+        if(i != index) {
+          copy->CopyData(node, i);
+        }
+      }
+
+      copy->CopyChildren(node);
+
+      return copy;
+    }
+
+    if(!(node->nodemap & bit)) {
+      return RootPtr<Node>();
+    }
+
+    size_t index = _Index(node->nodemap, bit);
+    RootPtr<Node> child = _Erase(node->children[index].Get(), shift + Bits, hash, key, removed);
+
+    if(!removed) {
+      return RootPtr<Node>();
+    }
+
+    // A child left with one entry is replaced by it.
+    if(child->children.empty() && child->keys.size() == 1) {
+
+      RootPtr<Node> copy(new Node(node->datamap | bit, node->nodemap ^ bit));
+      size_t at = _Index(node->datamap, bit);
+
+      for(size_t i = 0; i < node->keys.size(); ++i) {
+        if(i == at) {
+          copy->CopyData(child.Get(), 0);
+        }
+        copy->CopyData(node, i);
+      }
+
+      if(at == node->keys.size()) {
+        copy->CopyData(child.Get(), 0);
+      }
+
+      for(size_t i = 0; i < node->children.size(); ++i) {
+        if(i != index) {
+          copy->CopyChild(node, i);
+        }
+      }
+
+      return copy;
+    }
+
+    RootPtr<Node> copy(new Node(node->datamap, node->nodemap));
+
+    for(size_t i = 0; i < node->keys.size(); ++i) {
+      copy->CopyData(node, i);
+    }
+
+    for(size_t i = 0; i < node->children.size(); ++i) {
+      if(i == index) {
+        copy->children.emplace_back(copy.Get(), child);
+      } else {
+        copy->CopyChild(node, i);
+      }
+    }
+
+    return copy;
+  }
+
+  static bool _Contains(const Node* node, const K& key) {
+    for(size_t i = 0; i < node->keys.size(); ++i) {
+      if(node->keys[i] == key) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  template<typename F>
+  static void _ForEach(const Node* node, F& f) {
+
+    for(size_t i = 0; i < node->keys.size(); ++i) {
+      f(node->keys[i], node->values[i].Get());
+    }
+
+    for(size_t i = 0; i < node->children.size(); ++i) {
+      _ForEach(node->children[i].Get(), f);
+    }
+  }
+
+  RootPtr<Node> _root;
+  Hash _hash;
+  size_t _size;
+
+}; // class PersistentMap
+
+#endif /* defined(__Dev__PersistentMap__) */
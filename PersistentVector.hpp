@@ -0,0 +1,249 @@
+//
+//  PersistentVector.h
+//
+//  An immutable vector of Collectables whose
+//  versions share structure.
+//
+
+#ifndef __Dev__PersistentVector__
+#define __Dev__PersistentVector__
+
+#include "Collector.hpp"
+
+// A vector where every update returns a new version and
+// leaves the old one as it was, so keeping old versions
+// around for undo is cheap. Elements live in a trie of
+// 32-way Collectable nodes, plus a tail node for the last
+// few elements. An update copies the path to the element,
+// O(log32 n) nodes, and shares everything else. A version
+// holds two roots, and the nodes only it used are
+// collected once it's gone.
+//
+// Versions can be read from several threads, since nodes
+// are never modified once they're reachable.
+template<typename T>
+class PersistentVector {
+
+public:
+
+  PersistentVector() : _root(new Node), _tail(new Node), _size(0), _shift(Bits) { }
+
+  size_t Size() const { return _size; }
+  bool Empty() const { return _size == 0; }
+
+  // Valid while this version is.
+  T* operator[](size_t i) const {
+    assert(i < _size);
+    return static_cast<T*>(_LeafFor(i)->slots[i & Mask].Get());
+  }
+
+  T* Back() const { return (*this)[_size - 1]; }
+
+  PersistentVector PushBack(const RootPtr<T>& value) const {
+
+    PersistentVector result(*this);
+    ++result._size;
+
+    // Room in the tail.
+    if(_size - _TailOffset() < Width) {
+      result._tail = _Copy(_tail.Get(), _tail->slots.size());
+      result._tail->slots.emplace_back(result._tail.Get(), value);
+      return result;
+    }
+
+    // Move the full tail into the trie, adding a level
+    // if the root is full.
+    if((_size >> Bits) > (size_t(1) << _shift)) {
+      RootPtr<Node> root(new Node);
+      root->slots.emplace_back(root.Get(), _root);
+      root->slots.emplace_back(root.Get(), _NewPath(_shift, _tail));
+      result._root = root;
+      result._shift += Bits;
+    } else {
+      result._root = _PushTail(_shift, _root.Get(), _tail);
+    }
+
+    result._tail = RootPtr<Node>(new Node);
+    result._tail->slots.emplace_back(result._tail.Get(), value);
+
+    return result;
+  }
+
+  PersistentVector Set(size_t i, const RootPtr<T>& value) const {
+
+    assert(i < _size);
+
+    PersistentVector result(*this);
+
+    if(i >= _TailOffset()) {
+      result._tail = _Copy(_tail.Get(), _tail->slots.size());
+      result._tail->slots[i & Mask] = value;
+    } else {
+      result._root = _Set(_shift, _root.Get(), i, value);
+    }
+
+    return result;
+  }
+
+  PersistentVector PopBack() const {
+
+    assert(_size > 0);
+
+    if(_size == 1) {
+      return PersistentVector();
+    }
+
+    PersistentVector result(*this);
+    --result._size;
+
+    if(_size - _TailOffset() > 1) {
+      result._tail = _Copy(_tail.Get(), _tail->slots.size() - 1);
+      return result;
+    }
+
+    // The tail is emptied, so the last leaf of the trie
+    // becomes the tail.
+    result._tail = RootPtr<Node>(_LeafFor(_size - 2));
+
+    RootPtr<Node> root = _PopTail(_shift, _root.Get());
+
+    if(!root) {
+      root = RootPtr<Node>(new Node);
+    }
+
+    if(_shift > Bits && root->slots.size() == 1) {
+      root = RootPtr<Node>(static_cast<Node*>(root->slots[0].Get()));
+      result._shift -= Bits;
+    }
+
+    result._root = root;
+
+    return result;
+  }
+
+private:
+
+  enum { Bits = 5, Width = 1 << Bits, Mask = Width - 1 };
+
+  // Slots hold Nodes in the trie, and Ts in leaves.
+  struct Node : public Collectable {
+    std::vector< EdgePtr<Collectable> > slots;
+  };
+
+  size_t _TailOffset() const {
+    return _size < Width ? 0 : ((_size - 1) >> Bits) << Bits;
+  }
+
+  Node* _LeafFor(size_t i) const {
+
+    if(i >= _TailOffset()) {
+      return _tail.Get();
+    }
+
+    Node* node = _root.Get();
+    for(size_t level = _shift; level > 0; level -= Bits) {
+      node = static_cast<Node*>(node->slots[(i >> level) & Mask].Get());
+    }
+
+    return node;
+  }
+
+  // Copy the first count slots of node.
+  static RootPtr<Node> _Copy(const Node* node, size_t count) {
+    RootPtr<Node> copy(new Node);
+    copy->slots.reserve(count + 1);
+    for(size_t i = 0; i < count; ++i) {
+      copy->slots.emplace_back(copy.Get(), node->slots[i]);
+    }
+    return copy;
+  }
+
+  // A chain of nodes from level down to leaf.
+  static RootPtr<Node> _NewPath(size_t level, const RootPtr<Node>& leaf) {
+
+    if(level == 0) {
+      return leaf;
+    }
+
+    RootPtr<Node> node(new Node);
+    node->slots.emplace_back(node.Get(), _NewPath(level - Bits, leaf));
+
+    return node;
+  }
+
+  RootPtr<Node> _PushTail(size_t level, const Node* parent, const RootPtr<Node>& tail) const {
+
+    size_t index = ((_size - 1) >> level) & Mask;
+    RootPtr<Node> copy = _Copy(parent, parent->slots.size());
+
+    RootPtr<Node> child;
+
+    if(level == Bits) {
+      child = tail;
+    } else if(index < parent->slots.size()) {
+      child = _PushTail(level - Bits, static_cast<Node*>(parent->slots[index].Get()), tail);
+    } else {
+      child = _NewPath(level - Bits, tail);
+    }
+
+    if(index < copy->slots.size()) {
+      copy->slots[index] = child;
+    } else {
+      copy->slots.emplace_back(copy.Get(), child);
+    }
+
+    return copy;
+  }
+
+  static RootPtr<Node> _Set(size_t level, const Node* node, size_t i, const RootPtr<T>& value) {
+
+    RootPtr<Node> copy = _Copy(node, node->slots.size());
+
+    if(level == 0) {
+      copy->slots[i & Mask] = value;
+    } else {
+      size_t index = (i >> level) & Mask;
+      copy->slots[index] = _Set(level - Bits, static_cast<Node*>(node->slots[index].Get()), i, value);
+    }
+
+    return copy;
+  }
+
+  // Remove the last leaf. Returns null if that
+  // leaves node empty.
+  RootPtr<Node> _PopTail(size_t level, const Node* node) const {
+
+    size_t index = ((_size - 2) >> level) & Mask;
+
+    if(level > Bits) {
+
+      RootPtr<Node> child = _PopTail(level - Bits, static_cast<Node*>(node->slots[index].Get()));
+
+      if(!child && index == 0) {
+        return RootPtr<Node>();
+      }
+
+      RootPtr<Node> copy = _Copy(node, child ? index + 1 : index);
+
+      if(child) {
+        copy->slots[index] = child;
+      }
+
+      return copy;
+    }
+
+    if(index == 0) {
+      return RootPtr<Node>();
+    }
+
+    return _Copy(node, index);
+  }
+
+  RootPtr<Node> _root;
+  RootPtr<Node> _tail;
+  size_t _size;
+  size_t _shift;
+
+}; // class PersistentVector
+
+#endif /* defined(__Dev__PersistentVector__) */
@@ -0,0 +1,87 @@
+//
+//  Renumber.cpp
+//
+//  Renumbers nodes in the order marking visits them,
+//  so the side tables are laid out the way marking
+//  walks them.
+//
+
+#include "Collector.hpp"
+
+void Collector::SetRenumbering(size_t interval) {
+
+  boost::mutex::scoped_lock lock(_mutex);
+
+  _renumberInterval = interval;
+  _marksSinceRenumber = 0;
+
+}
+
+void Collector::_Renumber() {
+
+  std::vector<NodeId> newIds(_nodes.size(), NoId);
+  std::vector<Collectable*> nodes;
+  nodes.reserve(_nodes.size() - _freeIds.size());
+
+  // Everything marked, in the order it was marked.
+  for(auto id : _markOrder) {
+    if(_nodes[id] && newIds[id] == NoId) {
+      newIds[id] = NodeId(nodes.size());
+      nodes.push_back(_nodes[id]);
+    }
+  }
+
+  // Then nodes which weren't marked, since they've
+  // not been rooted yet.
+  for(NodeId id = 0; id < _nodes.size(); ++id) {
+    if(_nodes[id] && newIds[id] == NoId) {
+      newIds[id] = NodeId(nodes.size());
+      nodes.push_back(_nodes[id]);
+    }
+  }
+
+  // Copy rather than move the connections, so they're
+  // allocated in the new order too.
+  std::vector<NodeInfo> info(nodes.size());
+
+  for(NodeId id = 0; id < _nodes.size(); ++id) {
+
+    if(newIds[id] == NoId) {
+      continue;
+    }
+
+    const NodeInfo& from = _info[id];
+    NodeInfo& to = info[newIds[id]];
+
+    to.rootCount = from.rootCount;
+    to.rootDomain = from.rootDomain;
+    to.sequence = from.sequence;
+    to.domain = from.domain;
+    to.tracked = from.tracked;
+
+    to.connections.reserve(from.connections.size());
+    for(auto adj : from.connections) {
+      assert(newIds[adj] != NoId);
+      to.connections.push_back(newIds[adj]);
+    }
+  }
+
+  for(NodeId id = 0; id < nodes.size(); ++id) {
+    nodes[id]->gcId = id;
+  }
+
+  _nodes.swap(nodes);
+  _info.swap(info);
+  _freeIds.clear();
+  _markOrder.clear();
+
+  // Freed candidates become NoId.
+  for(auto& id : _candidates) {
+    id = id < newIds.size() ? newIds[id] : NoId;
+  }
+
+  if(_targetBudget) {
+    _BuildReferrers();
+  }
+
+}
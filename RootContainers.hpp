@@ -0,0 +1,187 @@
+//
+//  RootContainers.h
+//
+//  Containers of roots which register with the
+//  collector once, rather than once per element.
+//
+
+#ifndef __Dev__RootContainers__
+#define __Dev__RootContainers__
+
+#include "Collector.hpp"
+
+// A vector of roots. Use instead of a std::vector of
+// RootPtrs when holding many references from something
+// which isn't collected. Adding and removing elements
+// doesn't generate any events.
+//
+// Like std::vector, only one thread should modify it at
+// a time. The lock is only against the collector.
+template<typename T>
+class RootVector : public RootContainer {
+
+public:
+
+  // Elements are attributed to domain. See
+  // Collector::GetDomainUsage.
+  explicit RootVector(unsigned domain = Collector::NoDomain) : _domain(domain) {
+    Collector::GetInstance().AddRootContainer(this);
+  }
+
+  ~RootVector() {
+    Collector::GetInstance().RemoveRootContainer(this);
+  }
+
+  size_t size() const { return _elements.size(); }
+  bool empty() const { return _elements.empty(); }
+
+  // The returned pointer is only safe to use while
+  // the element stays in the vector.
+  T* operator[](size_t i) const { return _elements[i]; }
+
+  T* back() const { return _elements.back(); }
+
+  typedef typename std::vector<T*>::const_iterator const_iterator;
+
+  const_iterator begin() const { return _elements.begin(); }
+  const_iterator end() const { return _elements.end(); }
+
+  void reserve(size_t n) {
+    boost::mutex::scoped_lock lock(_mutex);
+    _elements.reserve(n);
+  }
+
+  void push_back(const RootPtr<T>& p) {
+    boost::mutex::scoped_lock lock(_mutex);
+    _elements.push_back(p.Get());
+  }
+
+  void Set(size_t i, const RootPtr<T>& p) {
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      _elements[i] = p.Get();
+    }
+    Collector::GetInstance().RootContainerChanged();
+  }
+
+  void pop_back() {
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      _elements.pop_back();
+    }
+    Collector::GetInstance().RootContainerChanged();
+  }
+
+  void erase(size_t i) {
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      _elements.erase(_elements.begin() + i);
+    }
+    Collector::GetInstance().RootContainerChanged();
+  }
+
+  void clear() {
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      _elements.clear();
+    }
+    Collector::GetInstance().RootContainerChanged();
+  }
+
+  unsigned GCDomain() const { return _domain; }
+
+  void GCTrace(std::vector<Collectable*>& nodes) {
+    boost::mutex::scoped_lock lock(_mutex);
+    for(auto p : _elements) {
+      if(p) {
+        nodes.push_back(p);
+      }
+    }
+  }
+
+private:
+
+  RootVector(const RootVector&);
+  RootVector& operator=(const RootVector&);
+
+  unsigned _domain;
+
+  std::vector<T*> _elements;
+  boost::mutex _mutex;
+
+}; // class RootVector
+
+// A set of roots. Like RootVector, it registers
+// with the collector once and adding and removing
+// elements doesn't generate any events.
+template<typename T>
+class RootSet : public RootContainer {
+
+public:
+
+  // Elements are attributed to domain. See
+  // Collector::GetDomainUsage.
+  explicit RootSet(unsigned domain = Collector::NoDomain) : _domain(domain) {
+    Collector::GetInstance().AddRootContainer(this);
+  }
+
+  ~RootSet() {
+    Collector::GetInstance().RemoveRootContainer(this);
+  }
+
+  size_t size() const { return _elements.size(); }
+  bool empty() const { return _elements.empty(); }
+
+  size_t count(T* p) const { return _elements.count(p); }
+
+  typedef typename std::set<T*>::const_iterator const_iterator;
+
+  const_iterator begin() const { return _elements.begin(); }
+  const_iterator end() const { return _elements.end(); }
+
+  bool insert(const RootPtr<T>& p) {
+    assert(p);
+    boost::mutex::scoped_lock lock(_mutex);
+    return _elements.insert(p.Get()).second;
+  }
+
+  size_t erase(T* p) {
+    size_t n;
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      n = _elements.erase(p);
+    }
+    if(n) {
+      Collector::GetInstance().RootContainerChanged();
+    }
+    return n;
+  }
+
+  void clear() {
+    {
+      boost::mutex::scoped_lock lock(_mutex);
+      _elements.clear();
+    }
+    Collector::GetInstance().RootContainerChanged();
+  }
+
+  unsigned GCDomain() const { return _domain; }
+
+  void GCTrace(std::vector<Collectable*>& nodes) {
+    boost::mutex::scoped_lock lock(_mutex);
+    nodes.insert(nodes.end(), _elements.begin(), _elements.end());
+  }
+
+private:
+
+  RootSet(const RootSet&);
+  RootSet& operator=(const RootSet&);
+
+  unsigned _domain;
+
+  std::set<T*> _elements;
+  boost::mutex _mutex;
+
+}; // class RootSet
+
+#endif /* defined(__Dev__RootContainers__) */
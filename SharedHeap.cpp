@@ -0,0 +1,106 @@
+//
+//  SharedHeap.cpp
+//
+
+#include "SharedHeap.hpp"
+#include <iostream>
+#include <new>
+#include <boost/interprocess/managed_shared_memory.hpp>
+
+namespace {
+
+  boost::interprocess::managed_shared_memory* segment = 0;
+  std::string segmentName;
+  const char* segmentBegin = 0;
+  const char* segmentEnd = 0;
+
+  // Collectables go in the segment once it exists.
+  class SegmentHeap : public CollectableHeap {
+
+  public:
+
+    void* Allocate(size_t size) {
+      return segment->allocate(size, std::nothrow);
+    }
+
+    bool Deallocate(void* p) {
+      if(! SharedHeap::Contains(p)) {
+        return false;
+      }
+      segment->deallocate(p);
+      return true;
+    }
+
+  };
+
+  SegmentHeap segmentHeap;
+
+}
+
+bool SharedHeap::Create(const std::string& name, size_t size, void* address, size_t ringSize) {
+
+  using namespace boost::interprocess;
+
+  assert(!segment);
+  assert(ringSize && (ringSize & (ringSize - 1)) == 0);
+
+  shared_memory_object::remove(name.c_str());
+
+  try {
+    segment = new managed_shared_memory(create_only, name.c_str(), size, address);
+  } catch(const interprocess_exception& e) {
+    std::cout << "Warning: can't create shared heap " << name << ": " << e.what() << std::endl;
+    segment = 0;
+    return false;
+  }
+
+  if(! Collector::GetInstance()._CreateSharedRing(segmentHeap, ringSize)) {
+    std::cout << "Warning: shared heap " << name << " has no room for the event ring" << std::endl;
+    delete segment;
+    segment = 0;
+    shared_memory_object::remove(name.c_str());
+    return false;
+  }
+
+  segmentName = name;
+  segmentBegin = static_cast<const char*>(segment->get_address());
+  segmentEnd = segmentBegin + segment->get_size();
+
+  Collectable::heap = &segmentHeap;
+
+  return true;
+}
+
+void SharedHeap::Unlink() {
+  if(segment) {
+    boost::interprocess::shared_memory_object::remove(segmentName.c_str());
+  }
+}
+
+bool SharedHeap::Active() {
+  return segment != 0;
+}
+
+void* SharedHeap::Allocate(size_t size) {
+
+  assert(segment);
+
+  // Containers expect a std::bad_alloc.
+  void* p = segment->allocate(size, std::nothrow);
+
+  if(! p) {
+    throw std::bad_alloc();
+  }
+
+  return p;
+}
+
+void SharedHeap::Deallocate(void* p) {
+  assert(Contains(p));
+  segment->deallocate(p);
+}
+
+bool SharedHeap::Contains(const void* p) {
+  const char* c = static_cast<const char*>(p);
+  return c >= segmentBegin && c < segmentEnd;
+}
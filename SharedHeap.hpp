@@ -0,0 +1,87 @@
+//
+//  SharedHeap.h
+//
+//  A Collectable heap shared by several worker
+//  processes, with one of them collecting.
+//
+
+#ifndef __Dev__SharedHeap__
+#define __Dev__SharedHeap__
+
+#include "Collector.hpp"
+
+// Puts Collectables, and the events describing their
+// graph, in shared memory mapped at a fixed address, so
+// worker processes can share one graph instead of each
+// having a copy.
+//
+// Create the heap at startup, before starting threads,
+// then fork the workers. They must not exec, since objects
+// are shared with their vtable pointers. All the processes
+// publish events to a ring in the heap, and only the
+// process which created the heap collects. In workers,
+// ProcessEvents leaves the ring alone, and Collect,
+// Checkpoint, Restore, CloneSubgraph and ForEachLive
+// warn and do nothing.
+//
+// Members of shared objects have to live in the heap too,
+// using SharedAllocator for containers. Root containers
+// and finalization registries only see the process they
+// were created in, so use them in the collecting process.
+class SharedHeap {
+
+public:
+
+  // Create a heap of size bytes mapped at address, with
+  // a ring of ringSize events (a power of two). Replaces
+  // any old heap with the same name. Returns false on
+  // failure.
+  static bool Create(const std::string& name, size_t size, void* address,
+                     size_t ringSize = 65536);
+
+  // Remove the heap's name, once the workers have forked.
+  // It stays mapped until the processes exit.
+  static void Unlink();
+
+  static bool Active();
+
+  static void* Allocate(size_t size);
+  static void Deallocate(void* p);
+
+  // Is p in the heap?
+  static bool Contains(const void* p);
+
+};
+
+// Allocator for containers in shared objects. Since the
+// heap is at the same address in every process, plain
+// pointers work.
+template<typename T>
+class SharedAllocator {
+
+public:
+
+  typedef T value_type;
+
+  SharedAllocator() { }
+
+  template<class U>
+  SharedAllocator(const SharedAllocator<U>&) { }
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(SharedHeap::Allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t) {
+    SharedHeap::Deallocate(p);
+  }
+
+  template<class U>
+  bool operator==(const SharedAllocator<U>&) const { return true; }
+
+  template<class U>
+  bool operator!=(const SharedAllocator<U>&) const { return false; }
+
+};
+
+#endif /* defined(__Dev__SharedHeap__) */
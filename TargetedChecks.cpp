@@ -0,0 +1,192 @@
+//
+//  TargetedChecks.cpp
+//
+//  Skips marking when the nodes which lost
+//  references can be shown to still be reachable.
+//
+
+#include "Collector.hpp"
+#include <algorithm>
+#include <unordered_set>
+
+void Collector::SetTargetedChecks(size_t budget) {
+
+  boost::mutex::scoped_lock lock(_mutex);
+
+  bool wasOn = _targetBudget != 0;
+  _targetBudget = budget;
+
+  if(! budget) {
+    std::vector< std::vector<NodeId> >().swap(_referrers);
+    std::vector<NodeId>().swap(_candidates);
+    _candidatesComplete = false;
+  } else if(! wasOn) {
+    _BuildReferrers();
+  }
+
+}
+
+void Collector::_AddCandidate(NodeId id, bool marking) {
+
+  // Past the budget it'll mark anyway, so stop recording.
+  if(_targetBudget && (marking || _candidates.size() <= _targetBudget)) {
+    _candidates.push_back(id);
+  }
+
+}
+
+bool Collector::_CandidatesReachable() {
+
+  if(_candidates.empty()) {
+    return true;
+  }
+
+  if(_candidates.size() > _targetBudget) {
+    return false;
+  }
+
+  size_t budget = _targetBudget;
+
+  // Nodes known to be reachable.
+  std::unordered_set<NodeId> reached;
+
+  // The containers haven't dropped anything, but may
+  // be all that holds some nodes. Tracing them can be
+  // costly, so it waits until a search needs it.
+  bool tracedContainers = false;
+
+  auto traceContainers = [&]() {
+
+    boost::mutex::scoped_lock lock(_containerMutex);
+
+    std::vector<NodeId> held;
+
+    for(auto container : _containers) {
+      _TraceContainer(container, held);
+
+      if(held.size() > budget) {
+        return false;
+      }
+    }
+
+    budget -= held.size();
+    reached.insert(held.begin(), held.end());
+    tracedContainers = true;
+
+    return true;
+  };
+
+  // Breadth first back from id, keeping where each node
+  // was reached from, so the path to the root can be
+  // added to reached. False if it found no root, or ran
+  // out of budget.
+  std::vector<NodeId> queue;
+  std::vector<size_t> from;
+  std::unordered_set<NodeId> seen;
+
+  auto searchBack = [&](NodeId id) {
+
+    queue.assign(1, id);
+    from.assign(1, 0);
+    seen.clear();
+    seen.insert(id);
+
+    for(size_t i = 0; i < queue.size(); ++i) {
+
+      NodeId node = queue[i];
+
+      if(_info[node].rootCount || reached.count(node)) {
+        for(size_t j = i; j != 0; j = from[j]) {
+          reached.insert(queue[j]);
+        }
+        reached.insert(id);
+        return true;
+      }
+
+      if(budget == 0) {
+        return false;
+      }
+
+      --budget;
+
+      for(auto referrer : _referrers[node]) {
+        if(seen.insert(referrer).second) {
+          queue.push_back(referrer);
+          from.push_back(i);
+        }
+      }
+    }
+
+    return false;
+  };
+
+  for(auto id : _candidates) {
+
+    if(id >= _nodes.size() || ! _nodes[id] || ! _info[id].tracked || reached.count(id)) {
+      continue;
+    }
+
+    if(searchBack(id)) {
+      continue;
+    }
+
+    // Nothing references it from a root, so unless a
+    // container holds something on the way, it's garbage.
+    if(tracedContainers) {
+      return false;
+    }
+
+    size_t known = reached.size();
+
+    if(! traceContainers() || reached.size() == known || ! searchBack(id)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void Collector::_BuildReferrers() {
+
+  std::vector< std::vector<NodeId> > referrers(_nodes.size());
+
+  for(NodeId id = 0; id < _nodes.size(); ++id) {
+    for(auto adj : _info[id].connections) {
+      referrers[adj].push_back(id);
+    }
+  }
+
+  _referrers.swap(referrers);
+
+}
+
+void Collector::_DropReferrers(const std::vector<NodeId>& garbage) {
+
+  auto isGarbage = [this](NodeId id) {
+    return _info[id].tracked && _info[id].sequence != _sequence;
+  };
+
+  std::vector<NodeId> targets;
+
+  for(auto id : garbage) {
+
+    std::vector<NodeId>().swap(_referrers[id]);
+
+    for(auto adj : _info[id].connections) {
+      if(! isGarbage(adj)) {
+        targets.push_back(adj);
+      }
+    }
+  }
+
+  std::sort(targets.begin(), targets.end());
+  targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+
+  for(auto id : targets) {
+
+    std::vector<NodeId>& referrers = _referrers[id];
+
+    referrers.erase(std::remove_if(referrers.begin(), referrers.end(), isGarbage), referrers.end());
+  }
+
+}